@@ -0,0 +1,83 @@
+def _wait_until(photon_client, loop, attempt, check_interval):
+  """Resolve a future with the result of attempt once it is not None.
+
+  attempt is called right away, whenever the connection's file descriptor
+  becomes readable, and every check_interval seconds. The periodic check is
+  needed because other calls on the client may read the message we wait for
+  from the socket, and then the file descriptor does not become readable
+  again. Event loops keep a single reader per file descriptor, so while both
+  a get_task and a submit are outstanding on the same client, one of them
+  also depends on the periodic check.
+  """
+  future = loop.create_future()
+  fd = photon_client.fileno()
+
+  result = attempt()
+  if result is not None:
+    future.set_result(result)
+    return future
+
+  def check():
+    if future.done():
+      return
+    result = attempt()
+    if result is None:
+      return
+    loop.remove_reader(fd)
+    future.set_result(result)
+
+  def check_periodically():
+    check()
+    if not future.done():
+      loop.call_later(check_interval, check_periodically)
+
+  def on_cancelled(future):
+    if future.cancelled():
+      loop.remove_reader(fd)
+
+  loop.add_reader(fd, check)
+  loop.call_later(check_interval, check_periodically)
+  future.add_done_callback(on_cancelled)
+  return future
+
+def get_task(photon_client, loop, check_interval=0.01):
+  """Get the next task from the local scheduler without blocking the loop.
+
+  This works with any event loop that provides add_reader, remove_reader,
+  call_later and create_future, such as asyncio. Only one call may be
+  outstanding per client.
+
+  Args:
+    photon_client: The photon.PhotonClient to get the task from.
+    loop: The event loop to wait on.
+    check_interval: How often to check for a task that was read by another
+      call on the client, in seconds.
+
+  Returns:
+    A future that resolves to the assigned photon.Task.
+  """
+  photon_client.request_task()
+  return _wait_until(photon_client, loop, photon_client.poll_task,
+                     check_interval)
+
+def submit(photon_client, task, loop, check_interval=0.01):
+  """Submit a task to the local scheduler without blocking the loop.
+
+  If the client is out of submission credits, this waits for the local
+  scheduler to grant more instead of blocking like photon_client.submit.
+  Tasks submitted by several outstanding calls may reach the local scheduler
+  in any order.
+
+  Args:
+    photon_client: The photon.PhotonClient to submit the task with.
+    task: The photon.Task to submit.
+    loop: The event loop to wait on.
+    check_interval: How often to check for credits that were granted while
+      another call on the client read from the socket, in seconds.
+
+  Returns:
+    A future that resolves to True once the task was submitted.
+  """
+  def attempt():
+    return True if photon_client.try_submit(task) else None
+  return _wait_until(photon_client, loop, attempt, check_interval)
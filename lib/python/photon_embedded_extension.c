@@ -0,0 +1,258 @@
+#include <Python.h>
+
+#include "common_extension.h"
+#include "photon_embedded.h"
+#include "task.h"
+
+/* This module links the whole local scheduler, which needs the Plasma client
+ * and Redis, so it is kept apart from the photon module that clients use. It
+ * works on the Task and ObjectID types of the photon module. */
+static PyTypeObject *task_type;
+static PyTypeObject *object_id_type;
+
+// clang-format off
+typedef struct {
+  PyObject_HEAD
+  photon_embedded *embedded;
+} PyEmbeddedScheduler;
+// clang-format on
+
+/**
+ * Check that a client index was returned by add_client, and raise an
+ * IndexError if it was not.
+ *
+ * @param self The embedded scheduler.
+ * @param client_index The client index to check.
+ * @return True if the client index is valid.
+ */
+static bool check_client_index(PyObject *self, long long client_index) {
+  photon_embedded *embedded = ((PyEmbeddedScheduler *)self)->embedded;
+  if (client_index < 0 ||
+      client_index >= photon_embedded_num_clients(embedded)) {
+    PyErr_SetString(PyExc_IndexError, "unknown client index");
+    return false;
+  }
+  return true;
+}
+
+static int PyEmbeddedScheduler_init(PyEmbeddedScheduler *self,
+                                    PyObject *args,
+                                    PyObject *kwds) {
+  if (!PyArg_ParseTuple(args, "")) {
+    return -1;
+  }
+  self->embedded = photon_embedded_start();
+  return 0;
+}
+
+static void PyEmbeddedScheduler_dealloc(PyEmbeddedScheduler *self) {
+  /* No thread can be calling into the scheduler anymore, because each call
+   * holds a reference to this object. */
+  if (self->embedded != NULL) {
+    photon_embedded_stop(self->embedded);
+  }
+  Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *PyEmbeddedScheduler_add_client(PyObject *self) {
+  return PyLong_FromLongLong(photon_embedded_add_client(
+      ((PyEmbeddedScheduler *)self)->embedded));
+}
+
+static PyObject *PyEmbeddedScheduler_submit(PyObject *self, PyObject *args) {
+  long long client_index;
+  PyObject *py_task;
+  if (!PyArg_ParseTuple(args, "LO!", &client_index, task_type, &py_task) ||
+      !check_client_index(self, client_index)) {
+    return NULL;
+  }
+  photon_embedded_submit(((PyEmbeddedScheduler *)self)->embedded, client_index,
+                         ((PyTask *)py_task)->spec);
+  Py_RETURN_NONE;
+}
+
+// clang-format off
+static PyObject *PyEmbeddedScheduler_get_task(PyObject *self, PyObject *args) {
+  long long client_index;
+  if (!PyArg_ParseTuple(args, "L", &client_index) ||
+      !check_client_index(self, client_index)) {
+    return NULL;
+  }
+  photon_embedded *embedded = ((PyEmbeddedScheduler *)self)->embedded;
+  task_spec *task_spec;
+  /* Drop the global interpreter lock while we wait for a task, so that other
+   * threads can submit tasks and finish theirs. */
+  Py_BEGIN_ALLOW_THREADS
+  task_spec = photon_embedded_get_task(embedded, client_index);
+  Py_END_ALLOW_THREADS
+  if (task_spec == NULL) {
+    Py_RETURN_NONE;
+  }
+  /* Like PyTask_make, but for the Task type of the photon module. */
+  PyTask *result = PyObject_New(PyTask, task_type);
+  result->spec = task_spec;
+  return (PyObject *)result;
+}
+// clang-format on
+
+static PyObject *PyEmbeddedScheduler_task_done(PyObject *self, PyObject *args) {
+  long long client_index;
+  PyObject *py_object_ids;
+  if (!PyArg_ParseTuple(args, "LO!", &client_index, &PyList_Type,
+                        &py_object_ids) ||
+      !check_client_index(self, client_index)) {
+    return NULL;
+  }
+  Py_ssize_t num_object_ids = PyList_Size(py_object_ids);
+  object_id *object_ids = malloc(num_object_ids * sizeof(object_id));
+  for (Py_ssize_t i = 0; i < num_object_ids; ++i) {
+    PyObject *py_object_id = PyList_GetItem(py_object_ids, i);
+    if (!PyObject_TypeCheck(py_object_id, object_id_type)) {
+      free(object_ids);
+      PyErr_SetString(PyExc_TypeError, "task_done expects a list of ObjectIDs");
+      return NULL;
+    }
+    object_ids[i] = ((PyObjectID *)py_object_id)->object_id;
+  }
+  photon_embedded_task_done(((PyEmbeddedScheduler *)self)->embedded,
+                            client_index, num_object_ids, object_ids);
+  free(object_ids);
+  Py_RETURN_NONE;
+}
+
+static PyObject *PyEmbeddedScheduler_cancel(PyObject *self, PyObject *args) {
+  PyObject *py_task;
+  if (!PyArg_ParseTuple(args, "O!", task_type, &py_task)) {
+    return NULL;
+  }
+  photon_embedded_cancel(((PyEmbeddedScheduler *)self)->embedded,
+                         ((PyTask *)py_task)->spec);
+  Py_RETURN_NONE;
+}
+
+static PyObject *PyEmbeddedScheduler_cancel_all(PyObject *self,
+                                                PyObject *args) {
+  long long client_index;
+  if (!PyArg_ParseTuple(args, "L", &client_index) ||
+      !check_client_index(self, client_index)) {
+    return NULL;
+  }
+  photon_embedded_cancel_all(((PyEmbeddedScheduler *)self)->embedded,
+                             client_index);
+  Py_RETURN_NONE;
+}
+
+static PyObject *PyEmbeddedScheduler_task_canceled(PyObject *self,
+                                                   PyObject *args) {
+  long long client_index;
+  PyObject *py_task;
+  if (!PyArg_ParseTuple(args, "LO!", &client_index, task_type, &py_task) ||
+      !check_client_index(self, client_index)) {
+    return NULL;
+  }
+  if (photon_embedded_task_canceled(((PyEmbeddedScheduler *)self)->embedded,
+                                    client_index, ((PyTask *)py_task)->spec)) {
+    Py_RETURN_TRUE;
+  }
+  Py_RETURN_FALSE;
+}
+
+static PyObject *PyEmbeddedScheduler_shutdown(PyObject *self) {
+  /* The scheduler is only freed when this object is, because other threads
+   * may still be about to call into it. */
+  photon_embedded_shutdown(((PyEmbeddedScheduler *)self)->embedded);
+  Py_RETURN_NONE;
+}
+
+static PyMethodDef PyEmbeddedScheduler_methods[] = {
+    {"add_client", (PyCFunction)PyEmbeddedScheduler_add_client, METH_NOARGS,
+     "Add a client and return its index."},
+    {"submit", (PyCFunction)PyEmbeddedScheduler_submit, METH_VARARGS,
+     "Submit a task on behalf of a client."},
+    {"get_task", (PyCFunction)PyEmbeddedScheduler_get_task, METH_VARARGS,
+     "Wait for a task for a worker. Returns None after shutdown."},
+    {"task_done", (PyCFunction)PyEmbeddedScheduler_task_done, METH_VARARGS,
+     "Tell the scheduler which objects the worker's finished task created."},
+    {"cancel", (PyCFunction)PyEmbeddedScheduler_cancel, METH_VARARGS,
+     "Cancel a task."},
+    {"cancel_all", (PyCFunction)PyEmbeddedScheduler_cancel_all, METH_VARARGS,
+     "Cancel all tasks that a client submitted."},
+    {"task_canceled", (PyCFunction)PyEmbeddedScheduler_task_canceled,
+     METH_VARARGS, "Return whether a task of a worker was canceled."},
+    {"shutdown", (PyCFunction)PyEmbeddedScheduler_shutdown, METH_NOARGS,
+     "Wake up all workers waiting in get_task and make them return None."},
+    {NULL} /* Sentinel */
+};
+
+static PyTypeObject PyEmbeddedSchedulerType = {
+    PyObject_HEAD_INIT(NULL) 0,              /* ob_size */
+    "photon_embedded.EmbeddedScheduler",     /* tp_name */
+    sizeof(PyEmbeddedScheduler),             /* tp_basicsize */
+    0,                                       /* tp_itemsize */
+    (destructor)PyEmbeddedScheduler_dealloc, /* tp_dealloc */
+    0,                                       /* tp_print */
+    0,                                       /* tp_getattr */
+    0,                                       /* tp_setattr */
+    0,                                       /* tp_compare */
+    0,                                       /* tp_repr */
+    0,                                       /* tp_as_number */
+    0,                                       /* tp_as_sequence */
+    0,                                       /* tp_as_mapping */
+    0,                                       /* tp_hash */
+    0,                                       /* tp_call */
+    0,                                       /* tp_str */
+    0,                                       /* tp_getattro */
+    0,                                       /* tp_setattro */
+    0,                                       /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,                      /* tp_flags */
+    "EmbeddedScheduler object",              /* tp_doc */
+    0,                                       /* tp_traverse */
+    0,                                       /* tp_clear */
+    0,                                       /* tp_richcompare */
+    0,                                       /* tp_weaklistoffset */
+    0,                                       /* tp_iter */
+    0,                                       /* tp_iternext */
+    PyEmbeddedScheduler_methods,             /* tp_methods */
+    0,                                       /* tp_members */
+    0,                                       /* tp_getset */
+    0,                                       /* tp_base */
+    0,                                       /* tp_dict */
+    0,                                       /* tp_descr_get */
+    0,                                       /* tp_descr_set */
+    0,                                       /* tp_dictoffset */
+    (initproc)PyEmbeddedScheduler_init,      /* tp_init */
+    0,                                       /* tp_alloc */
+    PyType_GenericNew,                       /* tp_new */
+};
+
+static PyMethodDef photon_embedded_methods[] = {
+    {NULL} /* Sentinel */
+};
+
+#ifndef PyMODINIT_FUNC /* declarations for DLL import/export */
+#define PyMODINIT_FUNC void
+#endif
+
+PyMODINIT_FUNC initphoton_embedded(void) {
+  PyObject *m;
+
+  PyObject *photon = PyImport_ImportModule("photon");
+  if (photon == NULL)
+    return;
+  /* We keep these references for the lifetime of the process. */
+  task_type = (PyTypeObject *)PyObject_GetAttrString(photon, "Task");
+  object_id_type = (PyTypeObject *)PyObject_GetAttrString(photon, "ObjectID");
+  Py_DECREF(photon);
+  if (task_type == NULL || object_id_type == NULL)
+    return;
+
+  if (PyType_Ready(&PyEmbeddedSchedulerType) < 0)
+    return;
+
+  m = Py_InitModule3("photon_embedded", photon_embedded_methods,
+                     "A module for running the local scheduler in-process.");
+
+  Py_INCREF(&PyEmbeddedSchedulerType);
+  PyModule_AddObject(m, "EmbeddedScheduler",
+                     (PyObject *)&PyEmbeddedSchedulerType);
+}
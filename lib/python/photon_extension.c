@@ -28,17 +28,67 @@ static void PyPhotonClient_dealloc(PyPhotonClient *self) {
   Py_TYPE(self)->tp_free((PyObject *)self);
 }
 
+// clang-format off
 static PyObject *PyPhotonClient_submit(PyObject *self, PyObject *args) {
   PyObject *py_task;
-  if (!PyArg_ParseTuple(args, "O", &py_task)) {
+  if (!PyArg_ParseTuple(args, "O!", &PyTaskType, &py_task)) {
     return NULL;
   }
-  photon_submit(((PyPhotonClient *)self)->photon_connection,
-                ((PyTask *)py_task)->spec);
+  photon_conn *conn = ((PyPhotonClient *)self)->photon_connection;
+  task_spec *spec = ((PyTask *)py_task)->spec;
+  /* Drop the global interpreter lock while we write the task because the
+   * socket write may block if the local scheduler is busy. The task stays
+   * alive because args holds a reference to it. */
+  Py_BEGIN_ALLOW_THREADS
+  photon_submit(conn, spec);
+  Py_END_ALLOW_THREADS
+  Py_RETURN_NONE;
+}
+
+static PyObject *PyPhotonClient_try_submit(PyObject *self, PyObject *args) {
+  PyObject *py_task;
+  if (!PyArg_ParseTuple(args, "O!", &PyTaskType, &py_task)) {
+    return NULL;
+  }
+  if (photon_try_submit(((PyPhotonClient *)self)->photon_connection,
+                        ((PyTask *)py_task)->spec) < 0) {
+    Py_RETURN_FALSE;
+  }
+  Py_RETURN_TRUE;
+}
+
+static PyObject *PyPhotonClient_submit_batch(PyObject *self, PyObject *args) {
+  PyObject *py_list;
+  if (!PyArg_ParseTuple(args, "O!", &PyList_Type, &py_list)) {
+    return NULL;
+  }
+  /* Copy the list into a tuple, so that other threads cannot remove and free
+   * the tasks while the interpreter lock is released. */
+  PyObject *py_tasks = PyList_AsTuple(py_list);
+  if (py_tasks == NULL) {
+    return NULL;
+  }
+  Py_ssize_t num_tasks = PyTuple_Size(py_tasks);
+  task_spec **specs = malloc(num_tasks * sizeof(task_spec *));
+  for (Py_ssize_t i = 0; i < num_tasks; ++i) {
+    PyObject *py_task = PyTuple_GetItem(py_tasks, i);
+    if (!PyObject_TypeCheck(py_task, &PyTaskType)) {
+      free(specs);
+      Py_DECREF(py_tasks);
+      PyErr_SetString(PyExc_TypeError, "submit_batch expects a list of tasks");
+      return NULL;
+    }
+    specs[i] = ((PyTask *)py_task)->spec;
+  }
+  photon_conn *conn = ((PyPhotonClient *)self)->photon_connection;
+  Py_BEGIN_ALLOW_THREADS
+  photon_submit_batch(conn, num_tasks, specs);
+  Py_END_ALLOW_THREADS
+  Py_DECREF(py_tasks);
+  free(specs);
   Py_RETURN_NONE;
 }
 
-// clang-format off
 static PyObject *PyPhotonClient_get_task(PyObject *self) {
   task_spec *task_spec;
   /* Drop the global interpreter lock while we get a task because
@@ -50,11 +100,117 @@ static PyObject *PyPhotonClient_get_task(PyObject *self) {
 }
 // clang-format on
 
+static PyObject *PyPhotonClient_request_task(PyObject *self) {
+  photon_request_task(((PyPhotonClient *)self)->photon_connection);
+  Py_RETURN_NONE;
+}
+
+static PyObject *PyPhotonClient_poll_task(PyObject *self) {
+  task_spec *task_spec =
+      photon_poll_task(((PyPhotonClient *)self)->photon_connection);
+  if (task_spec == NULL) {
+    Py_RETURN_NONE;
+  }
+  return PyTask_make(task_spec);
+}
+
+static PyObject *PyPhotonClient_task_done(PyObject *self, PyObject *args) {
+  PyObject *py_object_ids;
+  if (!PyArg_ParseTuple(args, "O!", &PyList_Type, &py_object_ids)) {
+    return NULL;
+  }
+  Py_ssize_t num_object_ids = PyList_Size(py_object_ids);
+  object_id *object_ids = malloc(num_object_ids * sizeof(object_id));
+  for (Py_ssize_t i = 0; i < num_object_ids; ++i) {
+    PyObject *py_object_id = PyList_GetItem(py_object_ids, i);
+    if (!PyObject_TypeCheck(py_object_id, &PyObjectIDType)) {
+      free(object_ids);
+      PyErr_SetString(PyExc_TypeError, "task_done expects a list of ObjectIDs");
+      return NULL;
+    }
+    object_ids[i] = ((PyObjectID *)py_object_id)->object_id;
+  }
+  photon_task_done(((PyPhotonClient *)self)->photon_connection,
+                   num_object_ids, object_ids);
+  free(object_ids);
+  Py_RETURN_NONE;
+}
+
+static PyObject *PyPhotonClient_register_worker(PyObject *self,
+                                                PyObject *args) {
+  int cpu = -1;
+  if (!PyArg_ParseTuple(args, "|i", &cpu)) {
+    return NULL;
+  }
+  photon_register_worker(((PyPhotonClient *)self)->photon_connection, cpu);
+  Py_RETURN_NONE;
+}
+
+static PyObject *PyPhotonClient_cancel(PyObject *self, PyObject *args) {
+  PyObject *py_task;
+  if (!PyArg_ParseTuple(args, "O!", &PyTaskType, &py_task)) {
+    return NULL;
+  }
+  photon_cancel(((PyPhotonClient *)self)->photon_connection,
+                ((PyTask *)py_task)->spec);
+  Py_RETURN_NONE;
+}
+
+static PyObject *PyPhotonClient_cancel_all(PyObject *self) {
+  photon_cancel_all(((PyPhotonClient *)self)->photon_connection);
+  Py_RETURN_NONE;
+}
+
+static PyObject *PyPhotonClient_task_canceled(PyObject *self, PyObject *args) {
+  PyObject *py_task;
+  if (!PyArg_ParseTuple(args, "O!", &PyTaskType, &py_task)) {
+    return NULL;
+  }
+  if (photon_task_canceled(((PyPhotonClient *)self)->photon_connection,
+                           ((PyTask *)py_task)->spec)) {
+    Py_RETURN_TRUE;
+  }
+  Py_RETURN_FALSE;
+}
+
+static PyObject *PyPhotonClient_fileno(PyObject *self) {
+  return PyInt_FromLong(((PyPhotonClient *)self)->photon_connection->conn);
+}
+
+static PyObject *PyPhotonClient_num_throttled(PyObject *self) {
+  return PyLong_FromLongLong(
+      ((PyPhotonClient *)self)->photon_connection->num_throttled);
+}
+
 static PyMethodDef PyPhotonClient_methods[] = {
     {"submit", (PyCFunction)PyPhotonClient_submit, METH_VARARGS,
      "Submit a task to the local scheduler."},
+    {"try_submit", (PyCFunction)PyPhotonClient_try_submit, METH_VARARGS,
+     "Submit a task if the local scheduler has room for it. Returns whether "
+     "the task was submitted."},
+    {"submit_batch", (PyCFunction)PyPhotonClient_submit_batch, METH_VARARGS,
+     "Submit a list of tasks to the local scheduler."},
     {"get_task", (PyCFunction)PyPhotonClient_get_task, METH_NOARGS,
      "Get a task from the local scheduler."},
+    {"request_task", (PyCFunction)PyPhotonClient_request_task, METH_NOARGS,
+     "Ask the local scheduler for a task without waiting for it."},
+    {"poll_task", (PyCFunction)PyPhotonClient_poll_task, METH_NOARGS,
+     "Return the requested task if it has arrived, otherwise None."},
+    {"task_done", (PyCFunction)PyPhotonClient_task_done, METH_VARARGS,
+     "Tell the local scheduler which objects the finished task sealed."},
+    {"register_worker", (PyCFunction)PyPhotonClient_register_worker,
+     METH_VARARGS,
+     "Register as a worker that the local scheduler pins to a CPU."},
+    {"cancel", (PyCFunction)PyPhotonClient_cancel, METH_VARARGS,
+     "Cancel a task."},
+    {"cancel_all", (PyCFunction)PyPhotonClient_cancel_all, METH_NOARGS,
+     "Cancel all tasks that this client submitted."},
+    {"task_canceled", (PyCFunction)PyPhotonClient_task_canceled, METH_VARARGS,
+     "Return whether a task this worker is executing was canceled."},
+    {"fileno", (PyCFunction)PyPhotonClient_fileno, METH_NOARGS,
+     "Return the file descriptor of the connection to the local scheduler."},
+    {"num_throttled", (PyCFunction)PyPhotonClient_num_throttled, METH_NOARGS,
+     "Return how often submitting a task had to wait for credits."},
     {NULL} /* Sentinel */
 };
 
@@ -8,7 +8,22 @@ photon_module = Extension("photon",
                           extra_objects=["../../build/photon_client.a", "../../common/build/libcommon.a"],
                           extra_compile_args=["--std=c99", "-Werror"])
 
+# The embedded local scheduler links the whole scheduler, including the Plasma
+# client and Redis, so it is a separate module that only users of
+# EmbeddedScheduler have to build against Plasma and hiredis.
+photon_embedded_module = Extension("photon_embedded",
+                                   sources=["photon_embedded_extension.c"],
+                                   include_dirs=["../../", "../../common/",
+                                                 "../../common/thirdparty/",
+                                                 "../../common/lib/python"],
+                                   extra_objects=["../../build/libphoton_scheduler.a",
+                                                  "../../../plasma/build/libplasma_client.a",
+                                                  "../../common/build/libcommon.a",
+                                                  "../../common/thirdparty/hiredis/libhiredis.a"],
+                                   extra_compile_args=["--std=c99", "-Werror"])
+
 setup(name="Photon",
       version="0.1",
       description="Photon library for Ray",
-      ext_modules=[photon_module])
+      ext_modules=[photon_module, photon_embedded_module],
+      py_modules=["photon_async"])
@@ -1,31 +1,121 @@
 #ifndef PHOTON_H
 #define PHOTON_H
 
+#include <stdbool.h>
+
 #include "common/task.h"
 #include "common/state/db.h"
+#include "photon_trace.h"
 #include "utarray.h"
 #include "uthash.h"
 
 enum photon_message_type {
-  /** Notify the local scheduler that a task has finished. */
+  /** Notify the local scheduler that a task has finished. The message contains
+   *  the IDs of the objects that the task sealed in the local object store. */
   TASK_DONE = 64,
   /** Get a new task from the local scheduler. */
   GET_TASK,
   /** This is sent from the local scheduler to a worker to tell the worker to
    *  execute a task. */
   EXECUTE_TASK,
+  /** This is sent from the local scheduler to a client to allow it to submit
+   *  more tasks. The message contains the number of additional tasks as an
+   *  int64_t. */
+  GRANT_CREDITS,
+  /** Register the client as a worker process. The message contains a
+   *  register_worker_info struct. */
+  REGISTER_WORKER,
+  /** Sent from a client to cancel a task. Sent from the local scheduler to a
+   *  worker to tell the worker that a task it is executing was canceled. In
+   *  both directions, the message contains the task_id of the task. */
+  CANCEL_TASK,
+  /** Cancel all tasks that the client submitted. */
+  CANCEL_CLIENT_TASKS,
+  /** Sent from a client that ran out of submission credits to ask for more.
+   *  The local scheduler answers with GRANT_CREDITS, which grants zero
+   *  credits if the client has to wait. */
+  REQUEST_CREDITS,
+  /** Sent from the local scheduler to take back the credits of a client,
+   *  because another client is waiting for some. */
+  RECLAIM_CREDITS,
+  /** The answer to RECLAIM_CREDITS. The message contains the number of
+   *  credits the client still held as an int64_t. */
+  RETURN_CREDITS,
 };
 
+/** The scheduling state of a task instance that was canceled before it
+ *  finished. This extends the task statuses defined in common/task.h. */
+#define TASK_STATUS_CANCELED (TASK_STATUS_DONE << 1)
+
+/** The contents of a REGISTER_WORKER message. The local scheduler pins the
+ *  process on the other end of the socket. */
+typedef struct {
+  /** The CPU the worker wants to run on, or -1 to let the local scheduler
+   *  pick one. */
+  int64_t cpu;
+} register_worker_info;
+
+/** A task that was assigned to a worker and that the worker did not report as
+ *  done yet. */
+typedef struct {
+  /** The task instance, or NULL. Its state is TASK_STATUS_CANCELED if the task
+   *  was canceled while the worker was executing it. */
+  task_instance *instance;
+  /** The index of the client that submitted the task, or -1 if unknown. */
+  int submitter_index;
+} worker_task;
+
 // clang-format off
 /** Contains all information that is associated to a worker. */
 typedef struct {
+  /** The socket of the worker, or -1 for a worker in this process. */
   int sock;
+  /** Number of tasks this client may still submit before it has to wait for
+   *  the local scheduler to grant more credits. */
+  int64_t credits;
+  /** True if the client is out of credits and we are withholding more. */
+  bool throttled;
+  /** Number of times the client ran out of credits because we withheld them.
+   *  Each period without credits counts once, until the next grant ends it.
+   *  The client counts the same way in photon_conn. */
+  int64_t num_throttled;
+  /** Credits we took back with RECLAIM_CREDITS that the client may still use
+   *  until it sees that message. They do not count as outstanding. */
+  int64_t reclaimed;
+  /** The CPU the worker is pinned to, or -1 if it did not register. */
+  int cpu;
+  /** The NUMA node of the worker's CPU, or -1 if it did not register. */
+  int numa_node;
+  /** True if the worker is executing a task. */
+  bool busy;
+  /** The task the worker was last assigned. The worker owns it until the
+   *  task is done. */
+  worker_task task;
+  /** The task the worker was assigned before, if it asked for the next task
+   *  before reporting this one as done. TASK_DONE refers to this task first. */
+  worker_task previous_task;
+  /** For in-process workers, which have no socket, the task that was
+   *  assigned to the worker and that it has not picked up yet. */
+  task_spec *assigned_task;
 } worker;
 // clang-format on
 
+/** Utilization statistics of a NUMA node. */
+typedef struct {
+  /** Number of registered workers on this node. */
+  int64_t num_workers;
+  /** Number of workers on this node that are executing a task. */
+  int64_t num_busy_workers;
+  /** Number of tasks assigned to workers on this node. */
+  int64_t num_tasks_assigned;
+  /** Number of those tasks whose inputs were mostly on this node. */
+  int64_t num_tasks_local;
+} numa_stats;
+
 /* These are needed to define the UT_arrays. */
 UT_icd task_ptr_icd;
 UT_icd worker_icd;
+UT_icd object_id_icd;
 
 /** Resources that are exposed to the scheduling algorithm. */
 typedef struct {
@@ -35,6 +125,13 @@ typedef struct {
   UT_array *workers;
   /* The handle to the database. */
   db_handle *db;
+  /** Number of NUMA nodes of this machine. */
+  int num_numa_nodes;
+  /** Utilization statistics for each NUMA node. */
+  numa_stats *numa_stats;
+  /** Buffer for tracing the lifecycle of tasks, or NULL if tracing is
+   *  disabled. */
+  trace_buffer *trace;
 } scheduler_info;
 
 #endif /* PHOTON_H */
@@ -1,7 +1,9 @@
 #include "photon_algorithm.h"
 
 #include <stdbool.h>
+#include <string.h>
 #include "utarray.h"
+#include "utlist.h"
 
 #include "state/task_log.h"
 #include "photon.h"
@@ -10,38 +12,327 @@
 typedef struct {
   /* Object id of this object. */
   object_id object_id;
+  /* NUMA node whose memory holds the object, or -1 if it is unknown. */
+  int numa_node;
   /* Handle for the uthash table. */
   UT_hash_handle handle;
 } available_object;
 
+typedef struct task_queue_entry task_queue_entry;
+
+/** The queued instances of a task. */
+typedef struct {
+  /** The ID of the task. */
+  task_id task_id;
+  /** A doubly-linked list of the queued instances of the task, linked through
+   *  the task_prev and task_next pointers of the queue entries. */
+  task_queue_entry *entries;
+  /** Handle for the uthash table that indexes the queue by task ID. */
+  UT_hash_handle handle;
+} task_index_entry;
+
+/** The queued tasks that a client submitted. */
+typedef struct {
+  /** The index of the client. */
+  int submitter_index;
+  /** A doubly-linked list of the queued tasks of the client, linked through
+   *  the submitter_prev and submitter_next pointers of the queue entries. */
+  task_queue_entry *entries;
+  /** Handle for the uthash table that indexes the queue by client. */
+  UT_hash_handle handle;
+} submitter_index_entry;
+
+/** A task that is waiting to be scheduled. */
+struct task_queue_entry {
+  /** The task instance. */
+  task_instance *task;
+  /** The index of the client that submitted the task, or -1 if unknown. */
+  int submitter_index;
+  /** True if the task was recorded as runnable in the trace. */
+  bool runnable;
+  /** Pointers for the doubly-linked task queue. */
+  task_queue_entry *prev;
+  task_queue_entry *next;
+  /** The entry of the task in the task index. */
+  task_index_entry *task_group;
+  /** Pointers for the list of queued instances of the same task. */
+  task_queue_entry *task_prev;
+  task_queue_entry *task_next;
+  /** The entry of the submitter in the submitter index, or NULL if the
+   *  submitter is unknown. */
+  submitter_index_entry *submitter_group;
+  /** Pointers for the list of queued tasks of the same submitter. */
+  task_queue_entry *submitter_prev;
+  task_queue_entry *submitter_next;
+};
+
 /** Part of the photon state that is maintained by the scheduling algorithm. */
 struct scheduler_state {
-  /** An array of pointers to tasks that are waiting to be scheduled. */
-  UT_array *task_queue;
+  /** A doubly-linked list of tasks that are waiting to be scheduled, in the
+   *  order they were submitted. */
+  task_queue_entry *task_queue;
+  /** The tasks in task_queue, indexed by their task ID, so a task can be
+   *  found without scanning the queue. */
+  task_index_entry *task_index;
+  /** The tasks in task_queue, indexed by the client that submitted them, so
+   *  the tasks of a client can be found without scanning the queue. */
+  submitter_index_entry *submitter_index;
+  /** The number of tasks in task_queue. */
+  int64_t task_queue_length;
   /** An array of worker indices corresponding to clients that are
    *  waiting for tasks. */
   UT_array *available_workers;
   /** A hash map of the objects that are available in the local Plasma store.
    *  This information could be a little stale. */
   available_object *local_objects;
+  /** The total size in bytes of the task specifications in task_queue. */
+  int64_t task_queue_bytes;
+  /** True if changes to task_queue are recorded in the journal. */
+  bool journal_enabled;
+  /** Records of the changes that were not written to a journal file yet. */
+  uint8_t *journal;
+  /** The number of bytes used in journal. */
+  int64_t journal_size;
+  /** The number of bytes allocated for journal. */
+  int64_t journal_capacity;
 };
 
+/** Magic number at the start of a snapshot file. */
+#define SNAPSHOT_MAGIC 0x50414e5354484f50
+/** Magic number at the start of a journal file. */
+#define JOURNAL_MAGIC 0x4c4e524a54484f50
+/** Version of the snapshot and journal format. Bump this when the layout
+ *  changes. */
+#define SNAPSHOT_FORMAT_VERSION 3
+/** The largest record we accept when reading a snapshot or a journal. */
+#define MAX_RECORD_SIZE (1 << 30)
+
+/** Types of the records in snapshots and journals. */
+typedef enum {
+  /** A task was added to the task queue. The payload is the task
+   *  specification. */
+  RECORD_TASK_QUEUED = 1,
+  /** A task left the task queue. There is no payload. */
+  RECORD_TASK_REMOVED,
+} record_type;
+
+/** The fixed size part of a record, which is followed by the payload. */
+typedef struct {
+  /** The type of the record. */
+  int64_t type;
+  /** The ID of the task instance the record is about, or NIL_ID. */
+  task_iid iid;
+  /** The size of the payload in bytes. */
+  int64_t length;
+  /** Checksum of the payload, see record_checksum. */
+  uint64_t checksum;
+} record_header;
+
+/** How many runnable tasks to look at when searching the task queue for a
+ *  task whose inputs are on the NUMA node of a worker. */
+#define NUMA_LOOKAHEAD 16
+
 scheduler_state *make_scheduler_state(void) {
   scheduler_state *state = malloc(sizeof(scheduler_state));
   /* Initialize an empty hash map for the cache of local available objects. */
   state->local_objects = NULL;
+  state->task_queue_bytes = 0;
+  state->journal_enabled = false;
+  state->journal = NULL;
+  state->journal_size = 0;
+  state->journal_capacity = 0;
   /* Initialize the local data structures used for queuing tasks and workers. */
-  utarray_new(state->task_queue, &task_ptr_icd);
+  state->task_queue = NULL;
+  state->task_index = NULL;
+  state->submitter_index = NULL;
+  state->task_queue_length = 0;
   utarray_new(state->available_workers, &ut_int_icd);
   return state;
 }
 
 void free_scheduler_state(scheduler_state *s) {
-  utarray_free(s->task_queue);
+  task_queue_entry *entry, *tmp;
+  DL_FOREACH_SAFE(s->task_queue, entry, tmp) {
+    free(entry->task);
+    free(entry);
+  }
+  task_index_entry *task_group, *tmp_task_group;
+  HASH_ITER(handle, s->task_index, task_group, tmp_task_group) {
+    HASH_DELETE(handle, s->task_index, task_group);
+    free(task_group);
+  }
+  submitter_index_entry *submitter_group, *tmp_submitter_group;
+  HASH_ITER(handle, s->submitter_index, submitter_group, tmp_submitter_group) {
+    HASH_DELETE(handle, s->submitter_index, submitter_group);
+    free(submitter_group);
+  }
   utarray_free(s->available_workers);
+  free(s->journal);
   free(s);
 }
 
+/**
+ * Compute the 64 bit FNV-1a hash of a record payload. Task specifications are
+ * opaque, so this is what guarantees that task_size only ever sees bytes we
+ * wrote ourselves when reading a snapshot back.
+ *
+ * @param payload The payload.
+ * @param length The size of the payload in bytes.
+ * @return The checksum.
+ */
+uint64_t record_checksum(const uint8_t *payload, int64_t length) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (int64_t i = 0; i < length; ++i) {
+    hash = (hash ^ payload[i]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+/**
+ * Fill in the header of a record. The header is zeroed first, so that no
+ * uninitialized padding bytes are written to files.
+ *
+ * @param header The header to fill in.
+ * @param type The type of the record.
+ * @param iid The ID of the task instance the record is about, or NIL_ID.
+ * @param payload The payload of the record.
+ * @param length The size of the payload in bytes.
+ * @return Void.
+ */
+void make_record_header(record_header *header,
+                        record_type type,
+                        task_iid iid,
+                        const void *payload,
+                        int64_t length) {
+  memset(header, 0, sizeof(*header));
+  header->type = type;
+  header->iid = iid;
+  header->length = length;
+  header->checksum = record_checksum(payload, length);
+}
+
+/**
+ * Append a record to the journal, if journaling is enabled.
+ *
+ * @param s The scheduler state.
+ * @param type The type of the record.
+ * @param iid The ID of the task instance the record is about, or NIL_ID.
+ * @param payload The payload of the record.
+ * @param length The size of the payload in bytes.
+ * @return Void.
+ */
+void journal_append(scheduler_state *s,
+                    record_type type,
+                    task_iid iid,
+                    const void *payload,
+                    int64_t length) {
+  if (!s->journal_enabled) {
+    return;
+  }
+  int64_t size = sizeof(record_header) + length;
+  if (s->journal_size + size > s->journal_capacity) {
+    int64_t capacity = s->journal_capacity > 0 ? s->journal_capacity : 4096;
+    while (s->journal_size + size > capacity) {
+      capacity *= 2;
+    }
+    s->journal = realloc(s->journal, capacity);
+    CHECK(s->journal != NULL);
+    s->journal_capacity = capacity;
+  }
+  record_header header;
+  make_record_header(&header, type, iid, payload, length);
+  memcpy(s->journal + s->journal_size, &header, sizeof(header));
+  memcpy(s->journal + s->journal_size + sizeof(header), payload, length);
+  s->journal_size += size;
+}
+
+/**
+ * Add a task to the end of the task queue. This passes ownership of the task
+ * instance to the queue.
+ *
+ * @param s The scheduler state.
+ * @param instance The task instance to add.
+ * @param submitter_index The index of the client that submitted the task.
+ * @return The entry of the task in the queue.
+ */
+task_queue_entry *queue_task(scheduler_state *s,
+                             task_instance *instance,
+                             int submitter_index) {
+  task_queue_entry *entry = malloc(sizeof(task_queue_entry));
+  entry->task = instance;
+  entry->submitter_index = submitter_index;
+  entry->runnable = false;
+  task_spec *spec = task_instance_task_spec(instance);
+  DL_APPEND(s->task_queue, entry);
+  /* Add the task to the list of queued instances of the task. */
+  task_id id = task_spec_id(spec);
+  task_index_entry *task_group;
+  HASH_FIND(handle, s->task_index, &id, sizeof(id), task_group);
+  if (task_group == NULL) {
+    task_group = malloc(sizeof(task_index_entry));
+    task_group->task_id = id;
+    task_group->entries = NULL;
+    HASH_ADD(handle, s->task_index, task_id, sizeof(task_id), task_group);
+  }
+  entry->task_group = task_group;
+  DL_APPEND2(task_group->entries, entry, task_prev, task_next);
+  /* Add the task to the list of queued tasks of its submitter. */
+  entry->submitter_group = NULL;
+  if (submitter_index >= 0) {
+    submitter_index_entry *submitter_group;
+    HASH_FIND(handle, s->submitter_index, &submitter_index,
+              sizeof(submitter_index), submitter_group);
+    if (submitter_group == NULL) {
+      submitter_group = malloc(sizeof(submitter_index_entry));
+      submitter_group->submitter_index = submitter_index;
+      submitter_group->entries = NULL;
+      HASH_ADD(handle, s->submitter_index, submitter_index,
+               sizeof(submitter_index), submitter_group);
+    }
+    entry->submitter_group = submitter_group;
+    DL_APPEND2(submitter_group->entries, entry, submitter_prev,
+               submitter_next);
+  }
+  s->task_queue_length += 1;
+  s->task_queue_bytes += task_size(spec);
+  journal_append(s, RECORD_TASK_QUEUED, *task_instance_id(instance), spec,
+                 task_size(spec));
+  return entry;
+}
+
+/**
+ * Remove a task from the task queue in constant time. This frees the queue
+ * entry and passes ownership of the task instance to the caller.
+ *
+ * @param s The scheduler state.
+ * @param entry The queue entry of the task.
+ * @return The task instance.
+ */
+task_instance *dequeue_task(scheduler_state *s, task_queue_entry *entry) {
+  task_instance *instance = entry->task;
+  DL_DELETE(s->task_queue, entry);
+  task_index_entry *task_group = entry->task_group;
+  DL_DELETE2(task_group->entries, entry, task_prev, task_next);
+  if (task_group->entries == NULL) {
+    HASH_DELETE(handle, s->task_index, task_group);
+    free(task_group);
+  }
+  submitter_index_entry *submitter_group = entry->submitter_group;
+  if (submitter_group != NULL) {
+    DL_DELETE2(submitter_group->entries, entry, submitter_prev,
+               submitter_next);
+    if (submitter_group->entries == NULL) {
+      HASH_DELETE(handle, s->submitter_index, submitter_group);
+      free(submitter_group);
+    }
+  }
+  s->task_queue_length -= 1;
+  s->task_queue_bytes -= task_size(task_instance_task_spec(instance));
+  journal_append(s, RECORD_TASK_REMOVED, *task_instance_id(instance), NULL, 0);
+  free(entry);
+  return instance;
+}
+
 /**
  * Check if all of the remote object arguments for a task are available in the
  * local object store.
@@ -68,9 +359,94 @@ bool can_run(scheduler_state *s, task_spec *task) {
   return true;
 }
 
+/**
+ * Find the NUMA node that holds most of the object arguments of a task. The
+ * node of an object is the node of the worker that reported creating it,
+ * because the pages of a new object are placed on the node that first
+ * writes them.
+ *
+ * @param info Info about resources exposed by photon to the scheduling
+ *        algorithm.
+ * @param s The scheduler state.
+ * @param task Task specification of the task to check.
+ * @return The index of the NUMA node, or -1 if the node of none of the
+ *         object arguments is known.
+ */
+int task_numa_node(scheduler_info *info, scheduler_state *s, task_spec *task) {
+  int64_t num_inputs[info->num_numa_nodes];
+  for (int i = 0; i < info->num_numa_nodes; ++i) {
+    num_inputs[i] = 0;
+  }
+  int64_t num_args = task_num_args(task);
+  for (int i = 0; i < num_args; ++i) {
+    if (task_arg_type(task, i) == ARG_BY_REF) {
+      object_id obj_id = *task_arg_id(task, i);
+      available_object *entry;
+      HASH_FIND(handle, s->local_objects, &obj_id, sizeof(object_id), entry);
+      if (entry != NULL && entry->numa_node >= 0) {
+        num_inputs[entry->numa_node] += 1;
+      }
+    }
+  }
+  int best_node = -1;
+  for (int i = 0; i < info->num_numa_nodes; ++i) {
+    if (num_inputs[i] > 0 &&
+        (best_node < 0 || num_inputs[i] > num_inputs[best_node])) {
+      best_node = i;
+    }
+  }
+  return best_node;
+}
+
+/**
+ * Assign a task to a worker and update the NUMA statistics and the trace.
+ * This passes ownership of the task instance to the worker, which keeps it
+ * until it is assigned its next task.
+ *
+ * @param info Info about resources exposed by photon to the scheduling
+ *        algorithm.
+ * @param s The scheduler state.
+ * @param instance The task instance to assign.
+ * @param submitter_index The index of the client that submitted the task.
+ * @param worker_index The index of the worker.
+ * @return Void.
+ */
+void assign_task(scheduler_info *info,
+                 scheduler_state *s,
+                 task_instance *instance,
+                 int submitter_index,
+                 int worker_index) {
+  task_spec *task = task_instance_task_spec(instance);
+  worker *w = (worker *) utarray_eltptr(info->workers, worker_index);
+  /* The worker may ask for this task before it reports its current one as
+   * done, so keep both. If it asked twice, it must have finished the older
+   * one without telling us. */
+  free(w->previous_task.instance);
+  w->previous_task = w->task;
+  w->task.instance = instance;
+  w->task.submitter_index = submitter_index;
+  trace_record(info->trace, *task_instance_id(instance), TRACE_DISPATCHED,
+               worker_index);
+  if (w->numa_node >= 0) {
+    numa_stats *stats = &info->numa_stats[w->numa_node];
+    stats->num_tasks_assigned += 1;
+    if (task_numa_node(info, s, task) == w->numa_node) {
+      stats->num_tasks_local += 1;
+    }
+  }
+  assign_task_to_worker(info, task, worker_index);
+  if (w->sock >= 0) {
+    /* In-process workers record this when they take the task. */
+    trace_record(info->trace, *task_instance_id(instance), TRACE_SENT,
+                 worker_index);
+  }
+}
+
 /**
  * If there is a task whose dependencies are available locally, assign it to the
- * worker. This does not remove the worker from the available worker queue.
+ * worker. Among the first runnable tasks, a task whose inputs are on the NUMA
+ * node of the worker is preferred. This does not remove the worker from the
+ * available worker queue.
  *
  * @param s The scheduler state.
  * @param worker_index The index of the worker.
@@ -80,63 +456,106 @@ bool can_run(scheduler_state *s, task_spec *task) {
 int find_and_schedule_task_if_possible(scheduler_info *info,
                                        scheduler_state *state,
                                        int worker_index) {
-  int found_task_to_schedule = 0;
-  /* Find the first task whose dependencies are available locally. */
-  task_spec *spec;
-  task_instance **task;
-  int i = 0;
-  for (; i < utarray_len(state->task_queue); ++i) {
-    task = (task_instance **) utarray_eltptr(state->task_queue, i);
-    spec = task_instance_task_spec(*task);
-    if (can_run(state, spec)) {
-      found_task_to_schedule = 1;
+  worker *w = (worker *) utarray_eltptr(info->workers, worker_index);
+  /* Find the first task whose dependencies are available locally and whose
+   * inputs are not on another NUMA node than the worker. */
+  task_queue_entry *first_runnable = NULL;
+  task_queue_entry *chosen = NULL;
+  int num_runnable = 0;
+  task_queue_entry *entry;
+  DL_FOREACH(state->task_queue, entry) {
+    task_spec *spec = task_instance_task_spec(entry->task);
+    if (!can_run(state, spec)) {
+      continue;
+    }
+    if (first_runnable == NULL) {
+      first_runnable = entry;
+    }
+    if (w->numa_node < 0) {
+      /* The worker did not register, so it has no preference. */
+      break;
+    }
+    int node = task_numa_node(info, state, spec);
+    if (node < 0 || node == w->numa_node) {
+      chosen = entry;
+      break;
+    }
+    num_runnable += 1;
+    if (num_runnable >= NUMA_LOOKAHEAD) {
       break;
     }
   }
+  if (chosen == NULL) {
+    chosen = first_runnable;
+  }
+  int found_task_to_schedule = (chosen != NULL);
   if (found_task_to_schedule) {
-    /* This task's dependencies are available locally, so assign the task to the
-     * worker. */
-    assign_task_to_worker(info, spec, worker_index);
-    /* Update the task queue data structure and free the task. */
-    free(*task);
-    utarray_erase(state->task_queue, i, 1);
+    /* This task's dependencies are available locally, so remove it from the
+     * task queue and assign it to the worker. */
+    if (!chosen->runnable) {
+      /* We did not see the task become runnable, for example because it was
+       * restored from a snapshot. */
+      trace_record(info->trace, *task_instance_id(chosen->task), TRACE_RUNNABLE,
+                   -1);
+    }
+    int submitter_index = chosen->submitter_index;
+    task_instance *instance = dequeue_task(state, chosen);
+    assign_task(info, state, instance, submitter_index, worker_index);
   }
   return found_task_to_schedule;
 }
 
 void handle_task_submitted(scheduler_info *info,
                            scheduler_state *s,
-                           task_spec *task) {
+                           task_spec *task,
+                           int submitter_index) {
   /* Create a unique task instance ID. This is different from the task ID and
    * is used to distinguish between potentially multiple executions of the
    * task. */
   task_iid task_iid = globally_unique_id();
   task_instance *instance =
       make_task_instance(task_iid, task, TASK_STATUS_WAITING, NIL_ID);
+  trace_record(info->trace, task_iid, TRACE_SUBMITTED, -1);
+  bool runnable = can_run(s, task);
   /* If this task's dependencies are available locally, and if there is an
    * available worker, then assign this task to an available worker. Otherwise,
    * add this task to the local task queue. */
-  int schedule_locally =
-      (utarray_len(s->available_workers) > 0) && can_run(s, task);
+  int schedule_locally = (utarray_len(s->available_workers) > 0) && runnable;
+  /* Submit the task to redis. */
+  if (info->db != NULL) {
+    task_log_add_task(info->db, instance);
+  }
   if (schedule_locally) {
-    /* Get the last available worker in the available worker queue. */
-    int *worker_index = (int *) utarray_back(s->available_workers);
-    /* Tell the available worker to execute the task. */
-    assign_task_to_worker(info, task, *worker_index);
+    /* Prefer an available worker on the NUMA node that holds most of the
+     * task's inputs. Otherwise take the last available worker in the queue. */
+    int num_available = utarray_len(s->available_workers);
+    int chosen = num_available - 1;
+    int node = task_numa_node(info, s, task);
+    for (int i = 0; node >= 0 && i < num_available; ++i) {
+      int *worker_index = (int *) utarray_eltptr(s->available_workers, i);
+      worker *w = (worker *) utarray_eltptr(info->workers, *worker_index);
+      if (w->numa_node == node) {
+        chosen = i;
+        break;
+      }
+    }
+    int *worker_index = (int *) utarray_eltptr(s->available_workers, chosen);
+    trace_record(info->trace, task_iid, TRACE_RUNNABLE, -1);
+    /* Tell the available worker to execute the task. This passes ownership of
+     * the task to the worker. */
+    assign_task(info, s, instance, submitter_index, *worker_index);
     /* Remove the available worker from the queue and free the struct. */
-    utarray_pop_back(s->available_workers);
+    utarray_erase(s->available_workers, chosen, 1);
   } else {
-    /* Add the task to the task queue. This passes ownership of the task queue.
-     * And the task will be freed when it is assigned to a worker. */
-    utarray_push_back(s->task_queue, &instance);
-  }
-  /* Submit the task to redis. */
-  task_log_add_task(info->db, instance);
-  if (schedule_locally) {
-    /* If the task was scheduled locally, we need to free it. Otherwise,
-     * ownership of the task is passed to the task_queue, and it will be freed
-     * when it is assigned to a worker. */
-    free(instance);
+    /* Add the task to the task queue. This passes ownership of the task to the
+     * task queue, and it will be passed on to a worker when one is assigned
+     * the task. */
+    task_queue_entry *entry = queue_task(s, instance, submitter_index);
+    entry->runnable = runnable;
+    trace_record(info->trace, task_iid, TRACE_QUEUED, -1);
+    if (runnable) {
+      trace_record(info->trace, task_iid, TRACE_RUNNABLE, -1);
+    }
   }
 }
 
@@ -161,13 +580,41 @@ void handle_worker_available(scheduler_info *info,
 
 void handle_object_available(scheduler_info *info,
                              scheduler_state *state,
-                             object_id object_id) {
+                             object_id object_id,
+                             int numa_node) {
+  available_object *entry;
+  HASH_FIND(handle, state->local_objects, &object_id, sizeof(object_id),
+            entry);
+  if (entry != NULL) {
+    /* We already know about this object, for example because the worker that
+     * created it reported it before Plasma did. */
+    if (entry->numa_node < 0) {
+      entry->numa_node = numa_node;
+    }
+    return;
+  }
   /* TODO(rkn): When does this get freed? */
-  available_object *entry =
-      (available_object *) malloc(sizeof(available_object));
+  entry = (available_object *) malloc(sizeof(available_object));
   entry->object_id = object_id;
+  entry->numa_node = numa_node;
   HASH_ADD(handle, state->local_objects, object_id, sizeof(object_id), entry);
 
+  if (info->trace != NULL) {
+    /* Record which sampled queued tasks became runnable. This walks the whole
+     * queue, so it is only done when tracing, and the dependencies are only
+     * checked for the tasks whose stages are recorded. */
+    task_queue_entry *queued;
+    DL_FOREACH(state->task_queue, queued) {
+      if (!queued->runnable &&
+          trace_sampled(info->trace, *task_instance_id(queued->task)) &&
+          can_run(state, task_instance_task_spec(queued->task))) {
+        queued->runnable = true;
+        trace_record(info->trace, *task_instance_id(queued->task),
+                     TRACE_RUNNABLE, -1);
+      }
+    }
+  }
+
   /* Check if we can schedule any tasks. */
   int num_tasks_scheduled = 0;
   for (int *p = (int *) utarray_front(state->available_workers); p != NULL;
@@ -182,3 +629,334 @@ void handle_object_available(scheduler_info *info,
   }
   utarray_erase(state->available_workers, 0, num_tasks_scheduled);
 }
+
+/**
+ * Mark a task instance as canceled in the task log and free it.
+ *
+ * @param info Info about resources exposed by photon to the scheduling
+ *        algorithm.
+ * @param instance The task instance that was canceled.
+ * @return Void.
+ */
+void cancel_task_instance(scheduler_info *info, task_instance *instance) {
+  *task_instance_state(instance) = TASK_STATUS_CANCELED;
+  if (info->db != NULL) {
+    task_log_add_task(info->db, instance);
+  }
+  free(instance);
+}
+
+int64_t handle_task_canceled(scheduler_info *info,
+                             scheduler_state *state,
+                             task_id task_id) {
+  int64_t num_canceled = 0;
+  task_index_entry *task_group;
+  HASH_FIND(handle, state->task_index, &task_id, sizeof(task_id), task_group);
+  if (task_group == NULL) {
+    return 0;
+  }
+  /* Remove every queued instance of the task. Dequeuing the last one frees
+   * the index entry, which the loop does not touch after it started. */
+  task_queue_entry *entry, *tmp;
+  DL_FOREACH_SAFE2(task_group->entries, entry, tmp, task_next) {
+    cancel_task_instance(info, dequeue_task(state, entry));
+    num_canceled += 1;
+  }
+  return num_canceled;
+}
+
+int64_t handle_client_tasks_canceled(scheduler_info *info,
+                                     scheduler_state *state,
+                                     int submitter_index) {
+  int64_t num_canceled = 0;
+  submitter_index_entry *submitter_group;
+  HASH_FIND(handle, state->submitter_index, &submitter_index,
+            sizeof(submitter_index), submitter_group);
+  if (submitter_group == NULL) {
+    return 0;
+  }
+  /* Dequeuing the last task of the client frees the index entry, which the
+   * loop does not touch after it started. */
+  task_queue_entry *entry, *tmp;
+  DL_FOREACH_SAFE2(submitter_group->entries, entry, tmp, submitter_next) {
+    cancel_task_instance(info, dequeue_task(state, entry));
+    num_canceled += 1;
+  }
+  return num_canceled;
+}
+
+int64_t scheduler_state_queue_length(scheduler_state *state) {
+  return state->task_queue_length;
+}
+
+int64_t scheduler_state_queue_bytes(scheduler_state *state) {
+  return state->task_queue_bytes;
+}
+
+/* Snapshots and journals are flat binary files made of records. A record
+ * is a record_header followed by length bytes of payload. A snapshot has the
+ * layout
+ *
+ *   uint64_t magic, int64_t format_version, int64_t generation,
+ *   int64_t num_records, then num_records records,
+ *
+ * and holds a RECORD_TASK_QUEUED record for each queued task. The cache of
+ * local objects is not saved, because objects may be evicted or sealed while
+ * the local scheduler is down, so it is rebuilt from the Plasma store on
+ * restart. A journal has the layout
+ *
+ *   uint64_t magic, int64_t format_version, int64_t generation,
+ *
+ * followed by records of the changes since the snapshot of the same
+ * generation, up to the end of the file. A crash while appending to the
+ * journal can leave an incomplete record at the end, which is ignored.
+ *
+ * They are only ever read back on the machine that wrote them, so integers are
+ * stored in native byte order. */
+
+/**
+ * Write a record to a file.
+ *
+ * @param file The file to write to.
+ * @param type The type of the record.
+ * @param iid The ID of the task instance the record is about, or NIL_ID.
+ * @param payload The payload of the record.
+ * @param length The size of the payload in bytes.
+ * @return Void.
+ */
+void write_record(FILE *file,
+                  record_type type,
+                  task_iid iid,
+                  const void *payload,
+                  int64_t length) {
+  record_header header;
+  make_record_header(&header, type, iid, payload, length);
+  fwrite(&header, sizeof(header), 1, file);
+  fwrite(payload, length, 1, file);
+}
+
+void write_scheduler_state(scheduler_state *state,
+                           FILE *file,
+                           int64_t generation) {
+  uint64_t magic = SNAPSHOT_MAGIC;
+  int64_t format_version = SNAPSHOT_FORMAT_VERSION;
+  int64_t num_records = state->task_queue_length;
+  fwrite(&magic, sizeof(magic), 1, file);
+  fwrite(&format_version, sizeof(format_version), 1, file);
+  fwrite(&generation, sizeof(generation), 1, file);
+  fwrite(&num_records, sizeof(num_records), 1, file);
+  task_queue_entry *queued;
+  DL_FOREACH(state->task_queue, queued) {
+    task_spec *spec = task_instance_task_spec(queued->task);
+    write_record(file, RECORD_TASK_QUEUED, *task_instance_id(queued->task),
+                 spec, task_size(spec));
+  }
+}
+
+void write_journal_header(FILE *file, int64_t generation) {
+  uint64_t magic = JOURNAL_MAGIC;
+  int64_t format_version = SNAPSHOT_FORMAT_VERSION;
+  fwrite(&magic, sizeof(magic), 1, file);
+  fwrite(&format_version, sizeof(format_version), 1, file);
+  fwrite(&generation, sizeof(generation), 1, file);
+}
+
+void enable_scheduler_state_journal(scheduler_state *state) {
+  state->journal_enabled = true;
+}
+
+int64_t scheduler_state_journal_size(scheduler_state *state) {
+  return state->journal_size;
+}
+
+bool write_journal(scheduler_state *state, FILE *file) {
+  if (fwrite(state->journal, state->journal_size, 1, file) != 1) {
+    return false;
+  }
+  clear_scheduler_state_journal(state);
+  return true;
+}
+
+void clear_scheduler_state_journal(scheduler_state *state) {
+  state->journal_size = 0;
+}
+
+/** A task that was read back from a snapshot or a journal. */
+typedef struct {
+  /** The ID of the task instance. */
+  task_iid iid;
+  /** The task instance. */
+  task_instance *instance;
+  /** Handle for the uthash table. */
+  UT_hash_handle handle;
+} restored_task;
+
+/**
+ * Get the number of bytes between the current position and the end of a
+ * file.
+ *
+ * @param file The file.
+ * @return The number of bytes left, or -1 if the file is not seekable.
+ */
+int64_t bytes_left(FILE *file) {
+  long position = ftell(file);
+  if (position < 0 || fseek(file, 0, SEEK_END) != 0) {
+    return -1;
+  }
+  long end = ftell(file);
+  if (fseek(file, position, SEEK_SET) != 0 || end < position) {
+    return -1;
+  }
+  return end - position;
+}
+
+/**
+ * Read a record and apply it to the restored tasks.
+ *
+ * @param file The file to read from.
+ * @param remaining The number of bytes left in the file. This is decreased by
+ *        the size of the record.
+ * @param tasks The hash table of restored tasks, in the order they were
+ *        queued.
+ * @return True if a valid record was read.
+ */
+bool read_record(FILE *file, int64_t *remaining, restored_task **tasks) {
+  record_header header;
+  if (*remaining < (int64_t) sizeof(header) ||
+      fread(&header, sizeof(header), 1, file) != 1) {
+    return false;
+  }
+  *remaining -= sizeof(header);
+  if (header.length < 0 || header.length > *remaining ||
+      header.length > MAX_RECORD_SIZE) {
+    return false;
+  }
+  uint8_t *payload = malloc(header.length > 0 ? header.length : 1);
+  if (payload == NULL) {
+    return false;
+  }
+  if ((header.length > 0 && fread(payload, header.length, 1, file) != 1) ||
+      record_checksum(payload, header.length) != header.checksum) {
+    free(payload);
+    return false;
+  }
+  *remaining -= header.length;
+  bool success = true;
+  restored_task *task;
+  HASH_FIND(handle, *tasks, &header.iid, sizeof(task_iid), task);
+  switch (header.type) {
+  case RECORD_TASK_QUEUED: {
+    task_spec *spec = (task_spec *) payload;
+    /* The checksum matched, so these are the bytes of a task we wrote. */
+    if (header.length == 0 || task_size(spec) != header.length) {
+      success = false;
+    } else if (task == NULL) {
+      task = malloc(sizeof(restored_task));
+      task->iid = header.iid;
+      /* Keep the task instance ID so that the restored task matches the entry
+       * that was already added to the task log before the restart. */
+      task->instance =
+          make_task_instance(header.iid, spec, TASK_STATUS_WAITING, NIL_ID);
+      HASH_ADD(handle, *tasks, iid, sizeof(task_iid), task);
+    }
+  } break;
+  case RECORD_TASK_REMOVED: {
+    if (task != NULL) {
+      HASH_DELETE(handle, *tasks, task);
+      free(task->instance);
+      free(task);
+    }
+  } break;
+  default:
+    success = false;
+  }
+  free(payload);
+  return success;
+}
+
+/**
+ * Read the header of a snapshot or a journal.
+ *
+ * @param file The file to read from.
+ * @param magic The magic number the file must start with.
+ * @param generation The generation of the file is stored here.
+ * @return True if the header is valid.
+ */
+bool read_header(FILE *file, uint64_t magic, int64_t *generation) {
+  uint64_t file_magic;
+  int64_t format_version;
+  return fread(&file_magic, sizeof(file_magic), 1, file) == 1 &&
+         file_magic == magic &&
+         fread(&format_version, sizeof(format_version), 1, file) == 1 &&
+         format_version == SNAPSHOT_FORMAT_VERSION &&
+         fread(generation, sizeof(*generation), 1, file) == 1;
+}
+
+bool read_scheduler_state(scheduler_state *state,
+                          FILE *snapshot,
+                          FILE *journal,
+                          UT_array *object_ids,
+                          int64_t *generation) {
+  int64_t num_records;
+  if (!read_header(snapshot, SNAPSHOT_MAGIC, generation) ||
+      fread(&num_records, sizeof(num_records), 1, snapshot) != 1 ||
+      num_records < 0) {
+    return false;
+  }
+  /* Read all tasks before adding any of them to the queue, so that an invalid
+   * snapshot does not leave the queue half restored. */
+  restored_task *tasks = NULL;
+  bool success = true;
+  int64_t remaining = bytes_left(snapshot);
+  for (int64_t i = 0; i < num_records; ++i) {
+    if (!read_record(snapshot, &remaining, &tasks)) {
+      success = false;
+      break;
+    }
+  }
+  /* Replay the changes since the snapshot. A journal of another generation
+   * belongs to an older snapshot whose changes are all in this one. */
+  int64_t journal_generation;
+  if (success && journal != NULL &&
+      read_header(journal, JOURNAL_MAGIC, &journal_generation) &&
+      journal_generation == *generation) {
+    remaining = bytes_left(journal);
+    while (read_record(journal, &remaining, &tasks)) {
+    }
+  }
+  /* The distinct objects that the restored tasks pass by reference. */
+  available_object *dependencies = NULL;
+  restored_task *task, *tmp;
+  HASH_ITER(handle, tasks, task, tmp) {
+    HASH_DELETE(handle, tasks, task);
+    if (success) {
+      task_spec *spec = task_instance_task_spec(task->instance);
+      for (int64_t i = 0; i < task_num_args(spec); ++i) {
+        if (task_arg_type(spec, i) != ARG_BY_REF) {
+          continue;
+        }
+        object_id obj_id = *task_arg_id(spec, i);
+        available_object *entry;
+        HASH_FIND(handle, dependencies, &obj_id, sizeof(object_id), entry);
+        if (entry == NULL) {
+          entry = malloc(sizeof(available_object));
+          entry->object_id = obj_id;
+          entry->numa_node = -1;
+          HASH_ADD(handle, dependencies, object_id, sizeof(object_id), entry);
+          utarray_push_back(object_ids, &obj_id);
+        }
+      }
+      /* The clients that submitted the tasks did not survive the restart. */
+      queue_task(state, task->instance, -1);
+    } else {
+      free(task->instance);
+    }
+    free(task);
+  }
+  available_object *entry, *tmp_entry;
+  HASH_ITER(handle, dependencies, entry, tmp_entry) {
+    HASH_DELETE(handle, dependencies, entry);
+    free(entry);
+  }
+  return success;
+}
@@ -1,6 +1,9 @@
 #ifndef PHOTON_ALGORITHM_H
 #define PHOTON_ALGORITHM_H
 
+#include <stdbool.h>
+#include <stdio.h>
+
 #include "photon.h"
 #include "common/task.h"
 
@@ -38,11 +41,14 @@ void free_scheduler_state(scheduler_state *state);
  *        algorithm.
  * @param state State of the scheduling algorithm.
  * @param task Task that is submitted by the worker.
+ * @param submitter_index The index of the worker that submitted the task, or
+ *        -1 if it is unknown.
  * @return Void.
  */
 void handle_task_submitted(scheduler_info *info,
                            scheduler_state *state,
-                           task_spec *task);
+                           task_spec *task,
+                           int submitter_index);
 
 /**
  * This function will be called when a task is assigned by the global scheduler
@@ -60,17 +66,21 @@ void handle_task_assigned(scheduler_info *info,
 
 /**
  * This function is called if a new object becomes available in the local
- * plasma store.
+ * plasma store. It may be called more than once for the same object, because
+ * both the worker that sealed the object and Plasma report it.
  *
  * @param info Info about resources exposed by photon to the scheduling
  *        algorithm.
  * @param state State of the scheduling algorithm.
  * @param object_id ID of the object that became available.
+ * @param numa_node The NUMA node whose memory holds the object, or -1 if it
+ *        is unknown.
  * @return Void.
  */
 void handle_object_available(scheduler_info *info,
                              scheduler_state *state,
-                             object_id object_id);
+                             object_id object_id,
+                             int numa_node);
 
 /**
  * This function is called when a new worker becomes available
@@ -85,4 +95,137 @@ void handle_worker_available(scheduler_info *info,
                              scheduler_state *state,
                              int worker_index);
 
+/**
+ * This function is called when a client cancels a task. Queued instances of
+ * the task are removed from the task queue and marked as canceled in the task
+ * log. Instances that are already running are not affected.
+ *
+ * @param info Info about resources exposed by photon to the scheduling
+ *        algorithm.
+ * @param state State of the scheduling algorithm.
+ * @param task_id The ID of the task that is canceled.
+ * @return The number of queued task instances that were canceled.
+ */
+int64_t handle_task_canceled(scheduler_info *info,
+                             scheduler_state *state,
+                             task_id task_id);
+
+/**
+ * This function is called when a client cancels all tasks it submitted.
+ * Queued tasks of the client are removed from the task queue and marked as
+ * canceled in the task log.
+ *
+ * @param info Info about resources exposed by photon to the scheduling
+ *        algorithm.
+ * @param state State of the scheduling algorithm.
+ * @param submitter_index The index of the worker that submitted the tasks.
+ * @return The number of queued task instances that were canceled.
+ */
+int64_t handle_client_tasks_canceled(scheduler_info *info,
+                                     scheduler_state *state,
+                                     int submitter_index);
+
+/**
+ * Get the number of tasks that are waiting in the queue of the scheduling
+ * algorithm. The local scheduler uses this for admission control.
+ *
+ * @param state State of the scheduling algorithm.
+ * @return The number of queued tasks.
+ */
+int64_t scheduler_state_queue_length(scheduler_state *state);
+
+/**
+ * Get the total size of the task specifications that are waiting in the queue
+ * of the scheduling algorithm.
+ *
+ * @param state State of the scheduling algorithm.
+ * @return The number of bytes held by queued tasks.
+ */
+int64_t scheduler_state_queue_bytes(scheduler_state *state);
+
+/**
+ * Write the queued tasks to a snapshot file.
+ * Changes made after this can be recorded in a journal of the same generation.
+ *
+ * @param state State of the scheduling algorithm.
+ * @param file The file to write the snapshot to.
+ * @param generation The generation of the snapshot.
+ * @return Void.
+ */
+void write_scheduler_state(scheduler_state *state,
+                           FILE *file,
+                           int64_t generation);
+
+/**
+ * Write the header of a journal file that records the changes made after the
+ * snapshot of the same generation.
+ *
+ * @param file The file to write the header to.
+ * @param generation The generation of the snapshot the journal belongs to.
+ * @return Void.
+ */
+void write_journal_header(FILE *file, int64_t generation);
+
+/**
+ * Start recording changes to the queued tasks in the journal of the state.
+ * The records are kept in memory until they are written with write_journal or
+ * dropped with clear_scheduler_state_journal.
+ *
+ * @param state State of the scheduling algorithm.
+ * @return Void.
+ */
+void enable_scheduler_state_journal(scheduler_state *state);
+
+/**
+ * Get the size of the journal records that were not written yet.
+ *
+ * @param state State of the scheduling algorithm.
+ * @return The number of bytes in the journal.
+ */
+int64_t scheduler_state_journal_size(scheduler_state *state);
+
+/**
+ * Append the journal records that were not written yet to a journal file.
+ *
+ * @param state State of the scheduling algorithm.
+ * @param file The journal file to append to.
+ * @return True if the records were written. If this is false, the records are
+ *         kept, but the file may end with an incomplete record.
+ */
+bool write_journal(scheduler_state *state, FILE *file);
+
+/**
+ * Drop the journal records that were not written yet, for example because a
+ * new snapshot includes them.
+ *
+ * @param state State of the scheduling algorithm.
+ * @return Void.
+ */
+void clear_scheduler_state_journal(scheduler_state *state);
+
+/**
+ * Restore the queued tasks from a snapshot file that was written by
+ * write_scheduler_state and the journal file of the same generation. The
+ * objects that the restored tasks depend on may have been sealed or evicted
+ * while the local scheduler was down, so their IDs are appended to object_ids
+ * for the caller to check against the local Plasma store and pass to
+ * handle_object_available.
+ *
+ * @param state State of the scheduling algorithm.
+ * @param snapshot The file to read the snapshot from.
+ * @param journal The file to read the journal from, or NULL. The journal is
+ *        ignored if it belongs to another generation, and reading it stops at
+ *        the first incomplete or invalid record.
+ * @param object_ids An array that the IDs of the objects the restored tasks
+ *        pass by reference are appended to, each ID once.
+ * @param generation The generation of the snapshot is stored here.
+ * @return True if the snapshot was read successfully. If this is false, no
+ *         tasks were restored.
+ */
+bool read_scheduler_state(scheduler_state *state,
+                          FILE *snapshot,
+                          FILE *journal,
+                          UT_array *object_ids,
+                          int64_t *generation);
+
 #endif /* PHOTON_ALGORITHM_H */
@@ -2,40 +2,341 @@
 
 #include "common/io.h"
 #include "common/task.h"
+#include <errno.h>
+#include <poll.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 photon_conn *photon_connect(const char *photon_socket) {
   photon_conn *result = malloc(sizeof(photon_conn));
   result->conn = connect_ipc_sock(photon_socket);
+  pthread_mutex_init(&result->lock, NULL);
+  pthread_cond_init(&result->message_received, NULL);
+  result->receiving = false;
+  result->task_requested = false;
+  /* We ask the local scheduler for credits when we first submit a task. */
+  result->credits = 0;
+  result->credits_requested = false;
+  result->num_throttled = 0;
+  result->throttled = false;
+  result->pending_task = NULL;
+  result->num_unfinished_tasks = 0;
   return result;
 }
 
-void photon_submit(photon_conn *conn, task_spec *task) {
-  write_message(conn->conn, SUBMIT_TASK, task_size(task), (uint8_t *)task);
+/**
+ * Forget the oldest task that we were assigned and did not report as done.
+ * This must be called with conn->lock held.
+ *
+ * @param conn The connection information.
+ * @return Void.
+ */
+static void remove_unfinished_task(photon_conn *conn) {
+  if (conn->num_unfinished_tasks == 0) {
+    return;
+  }
+  conn->num_unfinished_tasks -= 1;
+  memmove(&conn->unfinished_tasks[0], &conn->unfinished_tasks[1],
+          conn->num_unfinished_tasks * sizeof(unfinished_task));
 }
 
-task_spec *photon_get_task(photon_conn *conn) {
-  write_message(conn->conn, GET_TASK, 0, NULL);
+/**
+ * Find a task that we were assigned and did not report as done. This must be
+ * called with conn->lock held.
+ *
+ * @param conn The connection information.
+ * @param task_id The ID of the task.
+ * @return The task, or NULL if there is no unfinished task with this ID.
+ */
+static unfinished_task *find_unfinished_task(photon_conn *conn,
+                                             task_id task_id) {
+  for (int i = 0; i < conn->num_unfinished_tasks; ++i) {
+    if (memcmp(&conn->unfinished_tasks[i].task_id, &task_id,
+               sizeof(task_id)) == 0) {
+      return &conn->unfinished_tasks[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Wait for a message from the local scheduler and process it. Credit grants
+ * are added to the connection, an assigned task is stored in
+ * conn->pending_task until it is picked up, and a cancellation marks the task
+ * in conn->unfinished_tasks. This must be called with conn->lock held. The
+ * lock is released while waiting.
+ *
+ * If another thread is already waiting for a message, this waits until that
+ * thread has processed one instead of reading from the socket itself, so the
+ * caller must check again whether what it waits for has happened.
+ *
+ * @param conn The connection information.
+ * @param timeout_ms How long to wait for a message. If this is 0, this does not
+ *        block, if this is -1, this blocks until a message arrives.
+ * @return True if a message may have been processed, false if the timeout
+ *         expired.
+ */
+static bool receive_message(photon_conn *conn, int timeout_ms) {
+  if (conn->receiving) {
+    if (timeout_ms == 0) {
+      /* The waiting thread will process the available messages. */
+      return false;
+    }
+    pthread_cond_wait(&conn->message_received, &conn->lock);
+    return true;
+  }
+  conn->receiving = true;
+  pthread_mutex_unlock(&conn->lock);
+  struct pollfd poll_fd = {.fd = conn->conn, .events = POLLIN};
+  int num_ready;
+  do {
+    num_ready = poll(&poll_fd, 1, timeout_ms);
+  } while (num_ready < 0 && errno == EINTR);
+  pthread_mutex_lock(&conn->lock);
+  conn->receiving = false;
+  /* Wake up the threads that waited for us, one of them may have to take over
+   * waiting for a message. */
+  pthread_cond_broadcast(&conn->message_received);
+  CHECK(num_ready >= 0);
+  if (num_ready == 0) {
+    return false;
+  }
+  /* The local scheduler writes each message at once, so once the first bytes
+   * are available the rest will follow shortly. */
   int64_t type;
   int64_t length;
   uint8_t *message;
+  read_message(conn->conn, &type, &length, &message);
+  switch (type) {
+  case EXECUTE_TASK: {
+    task_spec *task = (task_spec *)message;
+    CHECK(length == task_size(task));
+    CHECK(conn->pending_task == NULL);
+    conn->pending_task = task;
+    conn->task_requested = false;
+    /* The local scheduler forgets the oldest task when it assigns a new one
+     * while it keeps the maximum, so do the same. */
+    if (conn->num_unfinished_tasks == MAX_UNFINISHED_TASKS) {
+      remove_unfinished_task(conn);
+    }
+    unfinished_task *unfinished =
+        &conn->unfinished_tasks[conn->num_unfinished_tasks++];
+    unfinished->task_id = task_spec_id(task);
+    unfinished->canceled = false;
+  } break;
+  case CANCEL_TASK: {
+    CHECK(length == sizeof(task_id));
+    task_id task_id;
+    memcpy(&task_id, message, sizeof(task_id));
+    unfinished_task *unfinished = find_unfinished_task(conn, task_id);
+    if (unfinished != NULL) {
+      unfinished->canceled = true;
+    }
+    free(message);
+  } break;
+  case GRANT_CREDITS: {
+    CHECK(length == sizeof(int64_t));
+    int64_t grant = *(int64_t *)message;
+    if (grant > 0) {
+      conn->credits += grant;
+      conn->credits_requested = false;
+      conn->throttled = false;
+    } else if (!conn->throttled) {
+      /* The local scheduler has no room for us, it grants credits later
+       * without another request. */
+      conn->throttled = true;
+      conn->num_throttled += 1;
+    }
+    free(message);
+  } break;
+  case RECLAIM_CREDITS: {
+    /* Another client is waiting for credits, and the local scheduler took
+     * ours back. We ask for credits again once we want to submit. */
+    int64_t credits = conn->credits;
+    conn->credits = 0;
+    write_message(conn->conn, RETURN_CREDITS, sizeof(credits),
+                  (uint8_t *)&credits);
+    free(message);
+  } break;
+  default:
+    /* This code should be unreachable. */
+    CHECK(0);
+  }
+  return true;
+}
+
+/**
+ * Process all messages from the local scheduler that are available right
+ * now, without blocking. This must be called with conn->lock held.
+ *
+ * @param conn The connection information.
+ * @return Void.
+ */
+static void receive_available_messages(photon_conn *conn) {
+  while (receive_message(conn, 0)) {
+  }
+}
+
+/**
+ * Ask the local scheduler for submission credits, unless we did already. This
+ * must be called with conn->lock held.
+ *
+ * @param conn The connection information.
+ * @return Void.
+ */
+static void request_credits(photon_conn *conn) {
+  if (!conn->credits_requested) {
+    conn->credits_requested = true;
+    write_message(conn->conn, REQUEST_CREDITS, 0, NULL);
+  }
+}
+
+void photon_submit(photon_conn *conn, task_spec *task) {
+  pthread_mutex_lock(&conn->lock);
+  /* Process new grants, and a RECLAIM_CREDITS message before we use credits
+   * that the local scheduler took back. */
+  receive_available_messages(conn);
+  if (conn->credits == 0) {
+    /* Wait until the local scheduler has room for more tasks. */
+    request_credits(conn);
+    while (conn->credits == 0) {
+      receive_message(conn, -1);
+    }
+  }
+  conn->credits -= 1;
+  write_message(conn->conn, SUBMIT_TASK, task_size(task), (uint8_t *)task);
+  pthread_mutex_unlock(&conn->lock);
+}
+
+int photon_try_submit(photon_conn *conn, task_spec *task) {
+  pthread_mutex_lock(&conn->lock);
+  /* Process new grants, and a RECLAIM_CREDITS message before we use credits
+   * that the local scheduler took back. */
+  receive_available_messages(conn);
+  if (conn->credits == 0) {
+    request_credits(conn);
+    pthread_mutex_unlock(&conn->lock);
+    errno = EAGAIN;
+    return -1;
+  }
+  conn->credits -= 1;
+  write_message(conn->conn, SUBMIT_TASK, task_size(task), (uint8_t *)task);
+  pthread_mutex_unlock(&conn->lock);
+  return 0;
+}
+
+void photon_submit_batch(photon_conn *conn,
+                         int64_t num_tasks,
+                         task_spec **tasks) {
+  for (int64_t i = 0; i < num_tasks; ++i) {
+    photon_submit(conn, tasks[i]);
+  }
+}
+
+/**
+ * Take the task that the local scheduler assigned to this client, if one has
+ * arrived. This must be called with conn->lock held.
+ *
+ * @param conn The connection information.
+ * @return The address of the assigned task, or NULL if there is none.
+ */
+static task_spec *take_pending_task(photon_conn *conn) {
+  task_spec *task = conn->pending_task;
+  conn->pending_task = NULL;
+  return task;
+}
+
+/**
+ * Send a GET_TASK message unless a task was already requested or has arrived.
+ * This must be called with conn->lock held.
+ *
+ * @param conn The connection information.
+ * @return Void.
+ */
+static void request_task(photon_conn *conn) {
+  if (conn->task_requested || conn->pending_task != NULL) {
+    return;
+  }
+  conn->task_requested = true;
+  write_message(conn->conn, GET_TASK, 0, NULL);
+}
+
+task_spec *photon_get_task(photon_conn *conn) {
+  pthread_mutex_lock(&conn->lock);
+  request_task(conn);
   /* Receive a task from the local scheduler. This will block until the local
    * scheduler gives this client a task. */
-  read_message(conn->conn, &type, &length, &message);
-  CHECK(type == EXECUTE_TASK);
-  task_spec *task = (task_spec *)message;
-  CHECK(length == task_size(task));
+  while (conn->pending_task == NULL) {
+    receive_message(conn, -1);
+  }
+  task_spec *task = take_pending_task(conn);
+  pthread_mutex_unlock(&conn->lock);
   return task;
 }
 
-void photon_task_done(photon_conn *conn) {
-  write_message(conn->conn, TASK_DONE, 0, NULL);
+void photon_request_task(photon_conn *conn) {
+  pthread_mutex_lock(&conn->lock);
+  request_task(conn);
+  pthread_mutex_unlock(&conn->lock);
+}
+
+task_spec *photon_poll_task(photon_conn *conn) {
+  pthread_mutex_lock(&conn->lock);
+  while (conn->pending_task == NULL && receive_message(conn, 0)) {
+  }
+  task_spec *task = take_pending_task(conn);
+  pthread_mutex_unlock(&conn->lock);
+  return task;
+}
+
+void photon_task_done(photon_conn *conn,
+                      int64_t num_object_ids,
+                      object_id *object_ids) {
+  pthread_mutex_lock(&conn->lock);
+  write_message(conn->conn, TASK_DONE, num_object_ids * sizeof(object_id),
+                (uint8_t *)object_ids);
+  remove_unfinished_task(conn);
+  pthread_mutex_unlock(&conn->lock);
+}
+
+void photon_register_worker(photon_conn *conn, int cpu) {
+  register_worker_info info = {.cpu = cpu};
+  pthread_mutex_lock(&conn->lock);
+  write_message(conn->conn, REGISTER_WORKER, sizeof(info), (uint8_t *)&info);
+  pthread_mutex_unlock(&conn->lock);
+}
+
+void photon_cancel(photon_conn *conn, task_spec *task) {
+  task_id task_id = task_spec_id(task);
+  pthread_mutex_lock(&conn->lock);
+  write_message(conn->conn, CANCEL_TASK, sizeof(task_id), (uint8_t *)&task_id);
+  pthread_mutex_unlock(&conn->lock);
+}
+
+void photon_cancel_all(photon_conn *conn) {
+  pthread_mutex_lock(&conn->lock);
+  write_message(conn->conn, CANCEL_CLIENT_TASKS, 0, NULL);
+  pthread_mutex_unlock(&conn->lock);
+}
+
+bool photon_task_canceled(photon_conn *conn, task_spec *task) {
+  pthread_mutex_lock(&conn->lock);
+  receive_available_messages(conn);
+  unfinished_task *unfinished = find_unfinished_task(conn, task_spec_id(task));
+  bool canceled = unfinished != NULL && unfinished->canceled;
+  pthread_mutex_unlock(&conn->lock);
+  return canceled;
 }
 
 void photon_disconnect(photon_conn *conn) {
+  pthread_mutex_lock(&conn->lock);
   write_message(conn->conn, DISCONNECT_CLIENT, 0, NULL);
+  pthread_mutex_unlock(&conn->lock);
 }
 
 void photon_log_message(photon_conn *conn) {
+  pthread_mutex_lock(&conn->lock);
   write_message(conn->conn, LOG_MESSAGE, 0, NULL);
+  pthread_mutex_unlock(&conn->lock);
 }
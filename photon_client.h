@@ -1,12 +1,61 @@
 #ifndef PHOTON_CLIENT_H
 #define PHOTON_CLIENT_H
 
+#include <pthread.h>
+#include <stdbool.h>
+
 #include "common/task.h"
 #include "photon.h"
 
+/* The local scheduler keeps track of at most this many unfinished tasks per
+ * worker: the task it executes and the next one if it asked for it early. */
+#define MAX_UNFINISHED_TASKS 2
+
+/* A task that we were assigned and did not report as done yet. */
+typedef struct {
+  /* The ID of the task. */
+  task_id task_id;
+  /* True if the local scheduler told us that the task was canceled. */
+  bool canceled;
+} unfinished_task;
+
 typedef struct {
-  /* File descriptor of the Unix domain socket that connects to photon. */
+  /* File descriptor of the Unix domain socket that connects to photon. This
+   * can be polled for readability to wait for a requested task. */
   int conn;
+  /* Protects the socket and the fields below, so that several threads can
+   * use the connection at once. */
+  pthread_mutex_t lock;
+  /* Signaled whenever a message from the local scheduler was processed, or a
+   * thread stopped waiting for one. */
+  pthread_cond_t message_received;
+  /* True while a thread waits for a message with the lock released. Only that
+   * thread may read from the socket. */
+  bool receiving;
+  /* True if we sent a GET_TASK message and have not received the task yet. */
+  bool task_requested;
+  /* Number of tasks we may submit before we have to wait for the local
+   * scheduler to grant more credits. */
+  int64_t credits;
+  /* True if we sent REQUEST_CREDITS and no credits were granted since. */
+  bool credits_requested;
+  /* Number of times the local scheduler told us to wait for credits. Each
+   * period without credits counts once, however many submissions fail during
+   * it, until the next grant ends it. The local scheduler counts the same
+   * way. */
+  int64_t num_throttled;
+  /* True if the local scheduler told us to wait for credits and no credits
+   * were granted since. */
+  bool throttled;
+  /* A task that the local scheduler assigned to us while we were waiting for
+   * something else, or NULL. */
+  task_spec *pending_task;
+  /* The tasks we were assigned and did not report as done yet, oldest first.
+   * This mirrors the tasks the local scheduler keeps for us, so TASK_DONE
+   * refers to the first one. */
+  unfinished_task unfinished_tasks[MAX_UNFINISHED_TASKS];
+  /* The number of entries in unfinished_tasks. */
+  int num_unfinished_tasks;
 } photon_conn;
 
 /**
@@ -19,7 +68,9 @@ typedef struct {
 photon_conn *photon_connect(const char *photon_socket);
 
 /**
- * Submit a task to the local scheduler.
+ * Submit a task to the local scheduler. Each submission uses up one credit
+ * granted by the local scheduler. If we are out of credits, this blocks until
+ * the local scheduler grants more.
  *
  * @param conn The connection information.
  * @param task The address of the task to submit.
@@ -27,6 +78,32 @@ photon_conn *photon_connect(const char *photon_socket);
  */
 void photon_submit(photon_conn *conn, task_spec *task);
 
+/**
+ * Submit a task to the local scheduler if we have a credit left. This never
+ * waits for the local scheduler to grant more credits. If we are out of
+ * credits, this asks for more, so a later call may succeed.
+ *
+ * @param conn The connection information.
+ * @param task The address of the task to submit.
+ * @return 0 if the task was submitted. If we are out of credits, this returns
+ *         -1 and sets errno to EAGAIN.
+ */
+int photon_try_submit(photon_conn *conn, task_spec *task);
+
+/**
+ * Submit a batch of tasks to the local scheduler. This is equivalent to
+ * calling photon_submit on each task in order, but lets bindings release
+ * their interpreter lock once for the whole batch.
+ *
+ * @param conn The connection information.
+ * @param num_tasks The number of tasks in the batch.
+ * @param tasks An array of the addresses of the tasks to submit.
+ * @return Void.
+ */
+void photon_submit_batch(photon_conn *conn,
+                         int64_t num_tasks,
+                         task_spec **tasks);
+
 /**
  * Get next task for this client. This will block until the scheduler assigns
  * a task to this worker. This allocates and returns a task, and so the task
@@ -40,12 +117,87 @@ void photon_submit(photon_conn *conn, task_spec *task);
 task_spec *photon_get_task(photon_conn *conn);
 
 /**
- * Tell the local scheduler that the client has finished executing a task.
+ * Ask the local scheduler for the next task for this client without waiting
+ * for the reply. The task can be retrieved with photon_poll_task once the
+ * connection's file descriptor becomes readable. Only one request is
+ * outstanding at a time, so this does nothing if a task was already requested
+ * or has arrived and not been picked up yet. Note that other calls on the
+ * connection may read the task from the socket, so check photon_poll_task
+ * before waiting for the file descriptor.
+ *
+ * @param conn The connection information.
+ * @return Void.
+ */
+void photon_request_task(photon_conn *conn);
+
+/**
+ * Check whether the task requested with photon_request_task has arrived. This
+ * never blocks. If a task is returned, it must be freed by the caller.
+ *
+ * @param conn The connection information.
+ * @return The address of the assigned task, or NULL if no task has arrived
+ *         yet.
+ */
+task_spec *photon_poll_task(photon_conn *conn);
+
+/**
+ * Tell the local scheduler that the client has finished executing a task. The
+ * scheduler treats the objects the task sealed as available right away, so
+ * tasks that depend on them do not have to wait for the notification from
+ * Plasma.
  *
  * @param conn The connection information.
+ * @param num_object_ids The number of objects the task sealed.
+ * @param object_ids The IDs of the objects the task sealed in the local object
+ *        store.
  * @return Void.
  */
-void photon_task_done(photon_conn *conn);
+void photon_task_done(photon_conn *conn,
+                      int64_t num_object_ids,
+                      object_id *object_ids);
+
+/**
+ * Register this process as a worker with the local scheduler. The local
+ * scheduler pins the process to a CPU and prefers to assign it tasks whose
+ * inputs are on the NUMA node of that CPU.
+ *
+ * @param conn The connection information.
+ * @param cpu The CPU to run on, or -1 to let the local scheduler pick one.
+ * @return Void.
+ */
+void photon_register_worker(photon_conn *conn, int cpu);
+
+/**
+ * Cancel a task. If the task is still queued, it is removed from the queue and
+ * never executed. If a worker is executing it, the worker is told so, see
+ * photon_task_canceled.
+ *
+ * @param conn The connection information.
+ * @param task The address of the task to cancel.
+ * @return Void.
+ */
+void photon_cancel(photon_conn *conn, task_spec *task);
+
+/**
+ * Cancel all tasks that this client submitted.
+ *
+ * @param conn The connection information.
+ * @return Void.
+ */
+void photon_cancel_all(photon_conn *conn);
+
+/**
+ * Check whether a task this worker is executing has been canceled. This never
+ * blocks. Workers should call this periodically during long running tasks
+ * and stop working on the task if it returns true. They still have to call
+ * photon_task_done afterwards.
+ *
+ * @param conn The connection information.
+ * @param task The task, as returned by photon_get_task or photon_poll_task.
+ * @return True if the task was canceled, false if it was not or it was already
+ *         reported as done.
+ */
+bool photon_task_canceled(photon_conn *conn, task_spec *task);
 
 /**
  * Disconnect from the local scheduler.
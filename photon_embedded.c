@@ -0,0 +1,151 @@
+#include "photon_embedded.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "event_loop.h"
+#include "photon.h"
+#include "photon_scheduler.h"
+
+/** Default number of submission credits per client. In-process clients are
+ *  not subject to flow control, so this only matters for the limits below. */
+#define EMBEDDED_MAX_CREDITS 1000
+/** Default number of queued tasks above which no more credits are granted. */
+#define EMBEDDED_MAX_QUEUE_LENGTH 100000
+
+struct photon_embedded {
+  /** The local scheduler. */
+  local_scheduler_state *state;
+  /** Protects the local scheduler, which is not thread safe itself. */
+  pthread_mutex_t lock;
+  /** Signaled whenever tasks may have been assigned to workers, and when the
+   *  scheduler shuts down. */
+  pthread_cond_t task_assigned;
+  /** True once the scheduler shuts down. From then on, get_task returns
+   *  NULL. */
+  bool shutting_down;
+  /** The number of threads that are waiting in get_task. */
+  int64_t num_waiting;
+  /** The number of clients that were added. Their indices are 0 to
+   *  num_clients - 1. */
+  int64_t num_clients;
+};
+
+photon_embedded *photon_embedded_start(void) {
+  photon_embedded *embedded = malloc(sizeof(photon_embedded));
+  /* The event loop is never run, it only owns the timers of the scheduler. */
+  event_loop *loop = event_loop_create();
+  embedded->state =
+      init_local_scheduler(loop, NULL, 0, NULL, NULL, EMBEDDED_MAX_CREDITS,
+                           EMBEDDED_MAX_QUEUE_LENGTH, NULL, 1);
+  pthread_mutex_init(&embedded->lock, NULL);
+  pthread_cond_init(&embedded->task_assigned, NULL);
+  embedded->shutting_down = false;
+  embedded->num_waiting = 0;
+  embedded->num_clients = 0;
+  return embedded;
+}
+
+void photon_embedded_shutdown(photon_embedded *embedded) {
+  pthread_mutex_lock(&embedded->lock);
+  embedded->shutting_down = true;
+  pthread_cond_broadcast(&embedded->task_assigned);
+  pthread_mutex_unlock(&embedded->lock);
+}
+
+void photon_embedded_stop(photon_embedded *embedded) {
+  pthread_mutex_lock(&embedded->lock);
+  embedded->shutting_down = true;
+  pthread_cond_broadcast(&embedded->task_assigned);
+  /* Wait for the threads in get_task to leave, so that they do not touch the
+   * scheduler after it is freed. */
+  while (embedded->num_waiting > 0) {
+    pthread_cond_wait(&embedded->task_assigned, &embedded->lock);
+  }
+  pthread_mutex_unlock(&embedded->lock);
+  free_local_scheduler(embedded->state);
+  pthread_mutex_destroy(&embedded->lock);
+  pthread_cond_destroy(&embedded->task_assigned);
+  free(embedded);
+}
+
+int64_t photon_embedded_add_client(photon_embedded *embedded) {
+  pthread_mutex_lock(&embedded->lock);
+  int64_t client_index = add_worker(embedded->state, -1);
+  embedded->num_clients += 1;
+  pthread_mutex_unlock(&embedded->lock);
+  return client_index;
+}
+
+int64_t photon_embedded_num_clients(photon_embedded *embedded) {
+  pthread_mutex_lock(&embedded->lock);
+  int64_t num_clients = embedded->num_clients;
+  pthread_mutex_unlock(&embedded->lock);
+  return num_clients;
+}
+
+void photon_embedded_submit(photon_embedded *embedded,
+                            int64_t client_index,
+                            task_spec *task) {
+  pthread_mutex_lock(&embedded->lock);
+  handle_client_submit(embedded->state, client_index, task);
+  pthread_cond_broadcast(&embedded->task_assigned);
+  pthread_mutex_unlock(&embedded->lock);
+}
+
+task_spec *photon_embedded_get_task(photon_embedded *embedded,
+                                    int64_t client_index) {
+  pthread_mutex_lock(&embedded->lock);
+  if (embedded->shutting_down) {
+    pthread_mutex_unlock(&embedded->lock);
+    return NULL;
+  }
+  handle_client_get_task(embedded->state, client_index);
+  embedded->num_waiting += 1;
+  task_spec *task;
+  while ((task = take_assigned_task(embedded->state, client_index)) == NULL &&
+         !embedded->shutting_down) {
+    pthread_cond_wait(&embedded->task_assigned, &embedded->lock);
+  }
+  embedded->num_waiting -= 1;
+  if (embedded->shutting_down) {
+    /* Wake up photon_embedded_stop, which waits for us to leave. */
+    pthread_cond_broadcast(&embedded->task_assigned);
+  }
+  pthread_mutex_unlock(&embedded->lock);
+  return task;
+}
+
+void photon_embedded_task_done(photon_embedded *embedded,
+                               int64_t client_index,
+                               int64_t num_object_ids,
+                               object_id *object_ids) {
+  pthread_mutex_lock(&embedded->lock);
+  handle_client_task_done(embedded->state, client_index, num_object_ids,
+                          object_ids);
+  pthread_cond_broadcast(&embedded->task_assigned);
+  pthread_mutex_unlock(&embedded->lock);
+}
+
+void photon_embedded_cancel(photon_embedded *embedded, task_spec *task) {
+  pthread_mutex_lock(&embedded->lock);
+  handle_client_cancel(embedded->state, task_spec_id(task));
+  pthread_mutex_unlock(&embedded->lock);
+}
+
+void photon_embedded_cancel_all(photon_embedded *embedded,
+                                int64_t client_index) {
+  pthread_mutex_lock(&embedded->lock);
+  handle_client_cancel_all(embedded->state, client_index);
+  pthread_mutex_unlock(&embedded->lock);
+}
+
+bool photon_embedded_task_canceled(photon_embedded *embedded,
+                                   int64_t client_index,
+                                   task_spec *task) {
+  pthread_mutex_lock(&embedded->lock);
+  bool canceled =
+      worker_task_canceled(embedded->state, client_index, task_spec_id(task));
+  pthread_mutex_unlock(&embedded->lock);
+  return canceled;
+}
@@ -0,0 +1,146 @@
+#ifndef PHOTON_EMBEDDED_H
+#define PHOTON_EMBEDDED_H
+
+#include <stdbool.h>
+
+#include "common/task.h"
+
+/* ==== Embedded local scheduler ====
+ *
+ * This runs the local scheduler inside the driver process, for single node
+ * runs and tests. Clients are identified by the index returned by
+ * photon_embedded_add_client, and talk to the scheduler with function calls
+ * instead of messages on a socket. Workers are threads of the process. All
+ * functions are thread safe. Passing a client index that was not returned by
+ * photon_embedded_add_client is undefined behavior.
+ *
+ * The embedded scheduler does not connect to Plasma or Redis. Workers tell it
+ * about the objects they create with photon_embedded_task_done, and tasks
+ * are not added to the task log. The scheduler code still refers to the
+ * Plasma client and the Redis task log, so programs that link
+ * libphoton_scheduler.a must also link libplasma_client.a, libcommon.a and
+ * libhiredis.a, in that order.
+ *
+ */
+
+typedef struct photon_embedded photon_embedded;
+
+/**
+ * Start an embedded local scheduler.
+ *
+ * @return The embedded local scheduler.
+ */
+photon_embedded *photon_embedded_start(void);
+
+/**
+ * Shut down an embedded local scheduler without freeing it. Threads that are
+ * blocked in photon_embedded_get_task return NULL, and so do later calls to
+ * it. This is useful if other threads may still call into the scheduler.
+ *
+ * @param embedded The embedded local scheduler.
+ * @return Void.
+ */
+void photon_embedded_shutdown(photon_embedded *embedded);
+
+/**
+ * Stop and free an embedded local scheduler. Threads that are blocked in
+ * photon_embedded_get_task return NULL, and this waits for them to do so. No
+ * other calls into the scheduler may be in progress or made afterwards.
+ *
+ * @param embedded The embedded local scheduler.
+ * @return Void.
+ */
+void photon_embedded_stop(photon_embedded *embedded);
+
+/**
+ * Add a client, that is a driver or a worker thread.
+ *
+ * @param embedded The embedded local scheduler.
+ * @return The index that identifies the client.
+ */
+int64_t photon_embedded_add_client(photon_embedded *embedded);
+
+/**
+ * Get the number of clients that were added. The valid client indices are 0
+ * up to this number minus one.
+ *
+ * @param embedded The embedded local scheduler.
+ * @return The number of clients.
+ */
+int64_t photon_embedded_num_clients(photon_embedded *embedded);
+
+/**
+ * Submit a task.
+ *
+ * @param embedded The embedded local scheduler.
+ * @param client_index The index of the submitting client.
+ * @param task The task to submit. This is copied, so it can be freed
+ *        afterwards.
+ * @return Void.
+ */
+void photon_embedded_submit(photon_embedded *embedded,
+                            int64_t client_index,
+                            task_spec *task);
+
+/**
+ * Get the next task for a worker. This blocks until the scheduler assigns a
+ * task to the worker or shuts down. The task must be freed by the caller.
+ *
+ * @param embedded The embedded local scheduler.
+ * @param client_index The index of the worker.
+ * @return The assigned task, or NULL if the scheduler shut down.
+ */
+task_spec *photon_embedded_get_task(photon_embedded *embedded,
+                                    int64_t client_index);
+
+/**
+ * Tell the scheduler that a worker has finished its task.
+ *
+ * @param embedded The embedded local scheduler.
+ * @param client_index The index of the worker.
+ * @param num_object_ids The number of objects the task created.
+ * @param object_ids The IDs of the objects the task created.
+ * @return Void.
+ */
+void photon_embedded_task_done(photon_embedded *embedded,
+                               int64_t client_index,
+                               int64_t num_object_ids,
+                               object_id *object_ids);
+
+/**
+ * Cancel a task. Queued instances of the task are never assigned to a worker,
+ * and workers that are executing it can see that with
+ * photon_embedded_task_canceled. Any client may cancel any task.
+ *
+ * @param embedded The embedded local scheduler.
+ * @param task The task to cancel.
+ * @return Void.
+ */
+void photon_embedded_cancel(photon_embedded *embedded, task_spec *task);
+
+/**
+ * Cancel all tasks that a client submitted.
+ *
+ * @param embedded The embedded local scheduler.
+ * @param client_index The index of the client.
+ * @return Void.
+ */
+void photon_embedded_cancel_all(photon_embedded *embedded,
+                                int64_t client_index);
+
+/**
+ * Check whether a task a worker is executing has been canceled. Workers
+ * should call this periodically and stop working on the task if it returns
+ * true. They still have to call photon_embedded_task_done.
+ *
+ * @param embedded The embedded local scheduler.
+ * @param client_index The index of the worker.
+ * @param task The task, as returned by photon_embedded_get_task.
+ * @return True if the task was canceled, false if it was not or it was already
+ *         reported as done.
+ */
+bool photon_embedded_task_canceled(photon_embedded *embedded,
+                                   int64_t client_index,
+                                   task_spec *task);
+
+#endif /* PHOTON_EMBEDDED_H */
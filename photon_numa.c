@@ -0,0 +1,94 @@
+#ifdef __linux__
+/* This is needed for sched_setaffinity, the CPU_* macros and struct ucred. */
+#define _GNU_SOURCE
+#include <sched.h>
+#include <sys/socket.h>
+#endif
+
+#include "photon_numa.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Find an entry of the form <prefix><number> in a directory.
+ *
+ * @param path The directory to search.
+ * @param prefix The prefix of the entry, for example "node".
+ * @param count If this is true, count the matching entries. Otherwise return
+ *        the number of the first matching entry.
+ * @return The number of matching entries or the number of the first matching
+ *         entry. If there is no matching entry, this returns -1.
+ */
+static int find_numbered_entry(const char *path, const char *prefix,
+                               bool count) {
+  DIR *dir = opendir(path);
+  if (dir == NULL) {
+    return -1;
+  }
+  size_t prefix_length = strlen(prefix);
+  int result = -1;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    const char *name = entry->d_name;
+    if (strncmp(name, prefix, prefix_length) != 0 ||
+        name[prefix_length] < '0' || name[prefix_length] > '9') {
+      continue;
+    }
+    if (!count) {
+      result = atoi(name + prefix_length);
+      break;
+    }
+    result = (result < 0) ? 1 : result + 1;
+  }
+  closedir(dir);
+  return result;
+}
+
+int numa_num_cpus(void) {
+  long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return num_cpus > 0 ? (int) num_cpus : 1;
+}
+
+int numa_num_nodes(void) {
+  int num_nodes = find_numbered_entry("/sys/devices/system/node", "node", true);
+  return num_nodes > 0 ? num_nodes : 1;
+}
+
+int numa_node_of_cpu(int cpu) {
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+  int node = find_numbered_entry(path, "node", false);
+  return node >= 0 ? node : 0;
+}
+
+bool numa_pin_process(pid_t pid, int cpu) {
+#ifdef __linux__
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  CPU_SET(cpu, &cpu_set);
+  return sched_setaffinity(pid, sizeof(cpu_set), &cpu_set) == 0;
+#else
+  /* Other platforms do not support pinning processes to CPUs. */
+  return false;
+#endif
+}
+
+bool numa_pin_socket_peer(int sock, int cpu) {
+#ifdef __linux__
+  /* Ask the kernel who is on the other end, so that clients cannot make us
+   * pin other processes. */
+  struct ucred credentials;
+  socklen_t length = sizeof(credentials);
+  if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &credentials, &length) != 0) {
+    return false;
+  }
+  return numa_pin_process(credentials.pid, cpu);
+#else
+  /* Other platforms do not support pinning processes to CPUs. */
+  return false;
+#endif
+}
@@ -0,0 +1,56 @@
+#ifndef PHOTON_NUMA_H
+#define PHOTON_NUMA_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/* ==== CPU and NUMA topology ====
+ *
+ * Helpers for finding out which CPUs and NUMA nodes this machine has and
+ * for pinning worker processes to a CPU. On platforms without NUMA
+ * information, all CPUs are reported to be on NUMA node 0.
+ *
+ */
+
+/**
+ * Get the number of CPUs that are online.
+ *
+ * @return The number of online CPUs.
+ */
+int numa_num_cpus(void);
+
+/**
+ * Get the number of NUMA nodes of this machine.
+ *
+ * @return The number of NUMA nodes, which is at least 1.
+ */
+int numa_num_nodes(void);
+
+/**
+ * Get the NUMA node that a CPU belongs to.
+ *
+ * @param cpu The index of the CPU.
+ * @return The index of the NUMA node of the CPU, or 0 if it is unknown.
+ */
+int numa_node_of_cpu(int cpu);
+
+/**
+ * Restrict a process to run only on a single CPU.
+ *
+ * @param pid The process ID of the process to pin.
+ * @param cpu The index of the CPU to pin the process to.
+ * @return True if the process was pinned, false otherwise.
+ */
+bool numa_pin_process(pid_t pid, int cpu);
+
+/**
+ * Restrict the process on the other end of a Unix domain socket to run only on
+ * a single CPU. The process is identified by the kernel, not by the client.
+ *
+ * @param sock The socket that is connected to the process.
+ * @param cpu The index of the CPU to pin the process to.
+ * @return True if the process was pinned, false otherwise.
+ */
+bool numa_pin_socket_peer(int sock, int cpu);
+
+#endif /* PHOTON_NUMA_H */
@@ -2,6 +2,7 @@
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
@@ -11,6 +12,7 @@
 #include "io.h"
 #include "photon.h"
 #include "photon_algorithm.h"
+#include "photon_numa.h"
 #include "photon_scheduler.h"
 #include "plasma_client.h"
 #include "state/db.h"
@@ -20,6 +22,33 @@
 
 UT_icd task_ptr_icd = {sizeof(task_instance *), NULL, NULL, NULL};
 UT_icd worker_icd = {sizeof(worker), NULL, NULL, NULL};
+UT_icd object_id_icd = {sizeof(object_id), NULL, NULL, NULL};
+
+/** How often changes to the scheduler state are appended to the journal. */
+#define SNAPSHOT_INTERVAL_MS 100
+/** The journal is compacted into a new snapshot once it is larger than the
+ *  snapshot and at least this large. */
+#define MIN_COMPACTION_BYTES (1 << 20)
+
+/** Default number of tasks a single client may have submitted but not yet
+ *  had admitted by the scheduler. */
+#define DEFAULT_MAX_CREDITS 1000
+/** Default number of queued tasks above which no more credits are granted. */
+#define DEFAULT_MAX_QUEUE_LENGTH 100000
+/** Size of the queued task specifications above which no more credits are
+ *  granted, to bound the memory used by the local scheduler. */
+#define MAX_QUEUE_BYTES (1 << 30)
+
+/** How often the utilization of the NUMA nodes is logged. */
+#define NUMA_STATS_INTERVAL_MS 10000
+
+/** Number of records the trace buffer holds. */
+#define TRACE_BUFFER_CAPACITY (1 << 20)
+/** How often we check whether the trace was requested with SIGUSR1. */
+#define TRACE_EXPORT_INTERVAL_MS 100
+
+/** Set by the SIGUSR1 handler to request exporting the trace. */
+volatile sig_atomic_t trace_export_requested = 0;
 
 /** Association between the socket fd of a worker and its worker_index. */
 typedef struct {
@@ -42,38 +71,273 @@ struct local_scheduler_state {
   scheduler_info *scheduler_info;
   /* State for the scheduling algorithm. */
   scheduler_state *scheduler_state;
+  /* Path of the snapshot file, or NULL if snapshots are disabled. */
+  const char *snapshot_path;
+  /* Path of the journal file of the changes since the snapshot. */
+  char *journal_path;
+  /* The open journal file, or NULL if it could not be opened. */
+  FILE *journal_file;
+  /* Generation of the current snapshot and journal. */
+  int64_t snapshot_generation;
+  /* Size of the current snapshot file in bytes. */
+  int64_t snapshot_bytes;
+  /* Size of the current journal file in bytes. */
+  int64_t journal_bytes;
+  /* The maximum number of credits a single client is granted. */
+  int64_t max_credits;
+  /* The queue length at which we stop granting credits. */
+  int64_t max_queue_length;
+  /* The number of clients that are out of credits because we withheld them. */
+  int64_t num_throttled_clients;
+  /* The total number of credits granted to clients and not used yet. Each of
+   * them may turn into a queued task. */
+  int64_t outstanding_credits;
+  /* The CPU that the next worker which does not ask for a CPU is pinned to. */
+  int next_cpu;
+  /* Path that the trace is exported to, or NULL if tracing is disabled. */
+  const char *trace_path;
 };
 
 local_scheduler_state *init_local_scheduler(event_loop *loop,
                                             const char *redis_addr,
                                             int redis_port,
-                                            const char *plasma_socket_name) {
+                                            const char *plasma_socket_name,
+                                            const char *snapshot_path,
+                                            int64_t max_credits,
+                                            int64_t max_queue_length,
+                                            const char *trace_path,
+                                            int64_t trace_sample_rate) {
   local_scheduler_state *state = malloc(sizeof(local_scheduler_state));
   state->loop = loop;
-  /* Connect to Plasma. This method will retry if Plasma hasn't started yet. */
-  state->plasma_conn = plasma_store_connect(plasma_socket_name);
-  /* Subscribe to notifications about sealed objects. */
-  int plasma_fd = plasma_subscribe(state->plasma_conn);
-  /* Add the callback that processes the notification to the event loop. */
-  event_loop_add_file(loop, plasma_fd, EVENT_LOOP_READ,
-                      process_plasma_notification, state);
+  state->plasma_conn = NULL;
+  if (plasma_socket_name != NULL) {
+    /* Connect to Plasma. This method will retry if Plasma hasn't started
+     * yet. */
+    state->plasma_conn = plasma_store_connect(plasma_socket_name);
+    /* Subscribe to notifications about sealed objects. */
+    int plasma_fd = plasma_subscribe(state->plasma_conn);
+    /* Add the callback that processes the notification to the event loop. */
+    event_loop_add_file(loop, plasma_fd, EVENT_LOOP_READ,
+                        process_plasma_notification, state);
+  }
   state->worker_index = NULL;
+  /* Configure the flow control for submitting clients. */
+  state->max_credits = max_credits;
+  state->max_queue_length = max_queue_length;
+  state->num_throttled_clients = 0;
+  state->outstanding_credits = 0;
   /* Add scheduler info. */
   state->scheduler_info = malloc(sizeof(scheduler_info));
   utarray_new(state->scheduler_info->workers, &worker_icd);
-  /* Connect to Redis. */
-  state->scheduler_info->db =
-      db_connect(redis_addr, redis_port, "photon", "", -1);
-  db_attach(state->scheduler_info->db, loop);
+  /* Find out about the NUMA nodes that workers can be placed on. */
+  state->scheduler_info->num_numa_nodes = numa_num_nodes();
+  state->scheduler_info->numa_stats =
+      calloc(state->scheduler_info->num_numa_nodes, sizeof(numa_stats));
+  state->next_cpu = 0;
+  event_loop_add_timer(loop, NUMA_STATS_INTERVAL_MS, numa_stats_timer_handler,
+                       state);
+  /* Set up tracing of the task lifecycles if it was requested. */
+  state->trace_path = trace_path;
+  state->scheduler_info->trace = NULL;
+  if (trace_path != NULL) {
+    state->scheduler_info->trace =
+        make_trace_buffer(TRACE_BUFFER_CAPACITY, trace_sample_rate);
+    event_loop_add_timer(loop, TRACE_EXPORT_INTERVAL_MS, trace_timer_handler,
+                         state);
+  }
+  /* Connect to Redis. Without Redis, tasks are not added to the task log. */
+  state->scheduler_info->db = NULL;
+  if (redis_addr != NULL) {
+    state->scheduler_info->db =
+        db_connect(redis_addr, redis_port, "photon", "", -1);
+    db_attach(state->scheduler_info->db, loop);
+  }
   /* Add scheduler state. */
   state->scheduler_state = make_scheduler_state();
+  /* Reload the state of a previous run of the local scheduler, and journal
+   * the changes to the state from now on. */
+  state->snapshot_path = snapshot_path;
+  state->journal_path = NULL;
+  state->journal_file = NULL;
+  state->snapshot_generation = 0;
+  state->snapshot_bytes = 0;
+  state->journal_bytes = 0;
+  if (snapshot_path != NULL) {
+    size_t path_length = strlen(snapshot_path) + sizeof(".log");
+    state->journal_path = malloc(path_length);
+    snprintf(state->journal_path, path_length, "%s.log", snapshot_path);
+    restore_local_scheduler(state);
+    enable_scheduler_state_journal(state->scheduler_state);
+    compact_snapshot(state);
+    event_loop_add_timer(loop, SNAPSHOT_INTERVAL_MS, snapshot_timer_handler,
+                         state);
+  }
   return state;
 };
 
+void compact_snapshot(local_scheduler_state *s) {
+  int64_t generation = s->snapshot_generation + 1;
+  /* Write to a temporary file and rename it over the old snapshot, so that a
+   * crash in the middle of writing never leaves a truncated snapshot behind.
+   * Until the journal of the new generation is written, the old journal is
+   * ignored because its generation does not match. */
+  size_t path_length = strlen(s->snapshot_path) + sizeof(".tmp");
+  char *tmp_path = malloc(path_length);
+  snprintf(tmp_path, path_length, "%s.tmp", s->snapshot_path);
+  FILE *file = fopen(tmp_path, "wb");
+  if (file == NULL) {
+    LOG_ERR("could not open snapshot file %s", tmp_path);
+    free(tmp_path);
+    return;
+  }
+  write_scheduler_state(s->scheduler_state, file, generation);
+  long snapshot_bytes = ftell(file);
+  if (fclose(file) != 0 || rename(tmp_path, s->snapshot_path) != 0) {
+    LOG_ERR("could not write snapshot file %s", s->snapshot_path);
+    free(tmp_path);
+    return;
+  }
+  free(tmp_path);
+  s->snapshot_generation = generation;
+  s->snapshot_bytes = snapshot_bytes;
+  clear_scheduler_state_journal(s->scheduler_state);
+  /* Start the journal of the new generation. */
+  if (s->journal_file != NULL) {
+    fclose(s->journal_file);
+  }
+  s->journal_file = fopen(s->journal_path, "wb");
+  s->journal_bytes = 0;
+  if (s->journal_file == NULL) {
+    LOG_ERR("could not open journal file %s", s->journal_path);
+    return;
+  }
+  write_journal_header(s->journal_file, generation);
+  if (fflush(s->journal_file) != 0) {
+    LOG_ERR("could not write journal file %s", s->journal_path);
+    fclose(s->journal_file);
+    s->journal_file = NULL;
+  }
+}
+
+void snapshot_local_scheduler(local_scheduler_state *s) {
+  int64_t journal_size = scheduler_state_journal_size(s->scheduler_state);
+  if (journal_size == 0) {
+    return;
+  }
+  /* Appending the changes is cheap, so do that until the journal outgrows the
+   * snapshot. Then rewrite the snapshot, which costs time proportional to the
+   * journal that was appended since the last one. */
+  int64_t max_journal_bytes = s->snapshot_bytes > MIN_COMPACTION_BYTES
+                                  ? s->snapshot_bytes
+                                  : MIN_COMPACTION_BYTES;
+  if (s->journal_file == NULL ||
+      s->journal_bytes + journal_size > max_journal_bytes) {
+    compact_snapshot(s);
+    return;
+  }
+  if (!write_journal(s->scheduler_state, s->journal_file) ||
+      fflush(s->journal_file) != 0) {
+    /* The journal may end with an incomplete record now, so start over from
+     * a new snapshot. */
+    LOG_ERR("could not write journal file %s", s->journal_path);
+    fclose(s->journal_file);
+    s->journal_file = NULL;
+    return;
+  }
+  s->journal_bytes += journal_size;
+}
+
+void restore_local_scheduler(local_scheduler_state *s) {
+  FILE *file = fopen(s->snapshot_path, "rb");
+  if (file == NULL) {
+    /* There is no snapshot, so this is a fresh start. */
+    return;
+  }
+  FILE *journal = fopen(s->journal_path, "rb");
+  UT_array *object_ids;
+  utarray_new(object_ids, &object_id_icd);
+  if (!read_scheduler_state(s->scheduler_state, file, journal, object_ids,
+                            &s->snapshot_generation)) {
+    LOG_ERR("ignoring invalid snapshot file %s", s->snapshot_path);
+  }
+  fclose(file);
+  if (journal != NULL) {
+    fclose(journal);
+  }
+  /* Plasma does not notify us about objects that were sealed while we were
+   * down, so ask it about each input of the restored tasks. Objects sealed
+   * from now on arrive through the Plasma notifications we subscribed to. */
+  for (object_id *p = (object_id *) utarray_front(object_ids); p != NULL;
+       p = (object_id *) utarray_next(object_ids, p)) {
+    int has_object = 0;
+    if (s->plasma_conn != NULL) {
+      plasma_contains(s->plasma_conn, *p, &has_object);
+    }
+    if (has_object) {
+      handle_object_available(s->scheduler_info, s->scheduler_state, *p, -1);
+    }
+  }
+  LOG_INFO("restored scheduler state from %s", s->snapshot_path);
+  utarray_free(object_ids);
+}
+
+int64_t snapshot_timer_handler(event_loop *loop,
+                               int64_t timer_id,
+                               void *context) {
+  snapshot_local_scheduler((local_scheduler_state *) context);
+  return SNAPSHOT_INTERVAL_MS;
+}
+
+void log_numa_stats(local_scheduler_state *s) {
+  for (int i = 0; i < s->scheduler_info->num_numa_nodes; ++i) {
+    numa_stats *stats = &s->scheduler_info->numa_stats[i];
+    LOG_INFO("NUMA node %d: %" PRId64 " of %" PRId64 " workers busy, %" PRId64
+             " tasks assigned, %" PRId64 " with local inputs",
+             i, stats->num_busy_workers, stats->num_workers,
+             stats->num_tasks_assigned, stats->num_tasks_local);
+  }
+}
+
+int64_t numa_stats_timer_handler(event_loop *loop,
+                                 int64_t timer_id,
+                                 void *context) {
+  log_numa_stats((local_scheduler_state *) context);
+  return NUMA_STATS_INTERVAL_MS;
+}
+
+void export_trace(local_scheduler_state *s) {
+  if (trace_export(s->scheduler_info->trace, s->trace_path)) {
+    LOG_INFO("exported task trace to %s", s->trace_path);
+  } else {
+    LOG_ERR("could not export task trace to %s", s->trace_path);
+  }
+}
+
+int64_t trace_timer_handler(event_loop *loop,
+                            int64_t timer_id,
+                            void *context) {
+  if (trace_export_requested) {
+    trace_export_requested = 0;
+    export_trace((local_scheduler_state *) context);
+  }
+  return TRACE_EXPORT_INTERVAL_MS;
+}
+
 void free_local_scheduler(local_scheduler_state *s) {
-  db_disconnect(s->scheduler_info->db);
+  log_numa_stats(s);
+  if (s->scheduler_info->db != NULL) {
+    db_disconnect(s->scheduler_info->db);
+  }
+  free(s->scheduler_info->numa_stats);
+  if (s->scheduler_info->trace != NULL) {
+    free_trace_buffer(s->scheduler_info->trace);
+  }
   free(s->scheduler_info);
   free_scheduler_state(s->scheduler_state);
+  if (s->journal_file != NULL) {
+    fclose(s->journal_file);
+  }
+  free(s->journal_path);
   event_loop_destroy(s->loop);
   free(s);
 }
@@ -83,9 +347,162 @@ void assign_task_to_worker(scheduler_info *info,
                            int worker_index) {
   CHECK(worker_index < utarray_len(info->workers));
   worker *w = (worker *) utarray_eltptr(info->workers, worker_index);
+  if (!w->busy && w->numa_node >= 0) {
+    info->numa_stats[w->numa_node].num_busy_workers += 1;
+  }
+  w->busy = true;
+  if (w->sock < 0) {
+    /* This is an in-process worker, so keep a copy of the task until the
+     * worker picks it up. */
+    CHECK(w->assigned_task == NULL);
+    w->assigned_task = malloc(task_size(task));
+    memcpy(w->assigned_task, task, task_size(task));
+    return;
+  }
   write_message(w->sock, EXECUTE_TASK, task_size(task), (uint8_t *) task);
 }
 
+void register_worker(local_scheduler_state *s,
+                     int64_t worker_index,
+                     register_worker_info *info) {
+  worker *w = (worker *) utarray_eltptr(s->scheduler_info->workers,
+                                        worker_index);
+  if (w->numa_node >= 0) {
+    LOG_ERR("ignoring repeated registration of worker_index %" PRId64,
+            worker_index);
+    return;
+  }
+  int num_cpus = numa_num_cpus();
+  int cpu = info->cpu;
+  if (cpu < 0 || cpu >= num_cpus) {
+    /* Spread the workers over the CPUs. */
+    cpu = s->next_cpu;
+    s->next_cpu = (s->next_cpu + 1) % num_cpus;
+  }
+  if (w->sock < 0 || !numa_pin_socket_peer(w->sock, cpu)) {
+    LOG_INFO("could not pin worker_index %" PRId64 " to CPU %d", worker_index,
+             cpu);
+  }
+  w->cpu = cpu;
+  w->numa_node = numa_node_of_cpu(cpu);
+  if (w->numa_node >= s->scheduler_info->num_numa_nodes) {
+    w->numa_node = 0;
+  }
+  s->scheduler_info->numa_stats[w->numa_node].num_workers += 1;
+  LOG_INFO("worker_index %" PRId64 " runs on CPU %d of NUMA node %d",
+           worker_index, w->cpu, w->numa_node);
+}
+
+bool grant_credits(local_scheduler_state *s, int64_t worker_index) {
+  worker *w = (worker *) utarray_eltptr(s->scheduler_info->workers,
+                                        worker_index);
+  if (w->sock < 0) {
+    /* In-process clients submit with a function call, so they cannot flood
+     * the socket buffers. */
+    return false;
+  }
+  if (!w->throttled && w->credits > 0 && s->num_throttled_clients > 0) {
+    /* Leave the room in the queue to the clients that are waiting. */
+    return false;
+  }
+  if (w->reclaimed > 0) {
+    /* Wait until the client saw our RECLAIM_CREDITS message, it asks for
+     * credits again afterwards. */
+    return false;
+  }
+  /* The window of credits shrinks as the queue fills up. The queued tasks and
+   * the credits of all clients together never exceed max_queue_length, so the
+   * queue cannot grow past it however many clients submit. Each client is
+   * granted at most max_credits. */
+  int64_t queue_length = scheduler_state_queue_length(s->scheduler_state);
+  int64_t queue_bytes = scheduler_state_queue_bytes(s->scheduler_state);
+  int64_t other_credits = s->outstanding_credits - w->credits;
+  int64_t window = s->max_queue_length - queue_length - other_credits;
+  if (queue_bytes >= MAX_QUEUE_BYTES || window < 0) {
+    window = 0;
+  }
+  if (window > s->max_credits) {
+    window = s->max_credits;
+  }
+  /* Only top up the credits once half of the window has been used, so that a
+   * client submitting many tasks does not cause a grant for every task. */
+  if (w->credits > window / 2 || w->credits >= window) {
+    return false;
+  }
+  int64_t grant = window - w->credits;
+  w->credits += grant;
+  s->outstanding_credits += grant;
+  if (w->throttled) {
+    w->throttled = false;
+    s->num_throttled_clients -= 1;
+  }
+  write_message(w->sock, GRANT_CREDITS, sizeof(grant), (uint8_t *) &grant);
+  return true;
+}
+
+void reclaim_credits(local_scheduler_state *s, int64_t worker_index) {
+  for (int64_t i = 0; i < utarray_len(s->scheduler_info->workers); ++i) {
+    worker *w = (worker *) utarray_eltptr(s->scheduler_info->workers, i);
+    if (i == worker_index || w->sock < 0 || w->credits == 0) {
+      continue;
+    }
+    /* Make the credits available to other clients right away, even if the
+     * client is busy and answers late. Only submissions that cross our
+     * message can still use them. */
+    w->reclaimed = w->credits;
+    s->outstanding_credits -= w->credits;
+    w->credits = 0;
+    write_message(w->sock, RECLAIM_CREDITS, 0, NULL);
+  }
+}
+
+void handle_client_request_credits(local_scheduler_state *s,
+                                   int64_t worker_index) {
+  worker *w = (worker *) utarray_eltptr(s->scheduler_info->workers,
+                                        worker_index);
+  if (grant_credits(s, worker_index) || w->credits > 0 || w->throttled) {
+    /* Either we granted credits now, or a grant is on its way, or the client
+     * is waiting for one already. */
+    return;
+  }
+  /* Clients that hold credits without using them would otherwise keep the
+   * room in the queue to themselves forever. */
+  reclaim_credits(s, worker_index);
+  if (grant_credits(s, worker_index)) {
+    return;
+  }
+  w->throttled = true;
+  w->num_throttled += 1;
+  s->num_throttled_clients += 1;
+  /* Tell the client that it has to wait, so that it can count this. */
+  int64_t grant = 0;
+  write_message(w->sock, GRANT_CREDITS, sizeof(grant), (uint8_t *) &grant);
+}
+
+void handle_client_return_credits(local_scheduler_state *s,
+                                  int64_t worker_index,
+                                  int64_t credits) {
+  worker *w = (worker *) utarray_eltptr(s->scheduler_info->workers,
+                                        worker_index);
+  /* The client returns what it still held when it saw our RECLAIM_CREDITS
+   * message. Its submissions before that used up the rest. */
+  if (credits != w->reclaimed) {
+    LOG_ERR("worker_index %" PRId64 " returned %" PRId64
+            " credits, but still held %" PRId64,
+            worker_index, credits, w->reclaimed);
+  }
+  w->reclaimed = 0;
+}
+
+void grant_throttled_clients(local_scheduler_state *s) {
+  for (int64_t i = 0; i < utarray_len(s->scheduler_info->workers); ++i) {
+    worker *w = (worker *) utarray_eltptr(s->scheduler_info->workers, i);
+    if (w->throttled) {
+      grant_credits(s, i);
+    }
+  }
+}
+
 void process_plasma_notification(event_loop *loop,
                                  int client_sock,
                                  void *context,
@@ -95,7 +512,174 @@ void process_plasma_notification(event_loop *loop,
   uint8_t *message = (uint8_t *) malloc(sizeof(object_id));
   recv(client_sock, message, sizeof(object_id), 0);
   object_id *obj_id = (object_id *) message;
-  handle_object_available(s->scheduler_info, s->scheduler_state, *obj_id);
+  handle_object_available(s->scheduler_info, s->scheduler_state, *obj_id, -1);
+  /* Tasks may have left the queue, so there may be room to admit more. */
+  if (s->num_throttled_clients > 0) {
+    grant_throttled_clients(s);
+  }
+}
+
+void handle_client_submit(local_scheduler_state *s,
+                          int64_t worker_index,
+                          task_spec *spec) {
+  worker *w =
+      (worker *) utarray_eltptr(s->scheduler_info->workers, worker_index);
+  if (w->sock >= 0) {
+    if (w->credits > 0) {
+      w->credits -= 1;
+      s->outstanding_credits -= 1;
+    } else if (w->reclaimed > 0) {
+      /* The client submitted this before it saw RECLAIM_CREDITS. */
+      w->reclaimed -= 1;
+    } else {
+      LOG_ERR("client on fd %d submitted a task without credits", w->sock);
+    }
+  }
+  handle_task_submitted(s->scheduler_info, s->scheduler_state, spec,
+                        worker_index);
+  grant_credits(s, worker_index);
+}
+
+void handle_client_task_done(local_scheduler_state *s,
+                             int64_t worker_index,
+                             int64_t num_object_ids,
+                             object_id *object_ids) {
+  worker *w =
+      (worker *) utarray_eltptr(s->scheduler_info->workers, worker_index);
+  /* A worker that asked for its next task early reports its older task as
+   * done first. */
+  worker_task *done = w->previous_task.instance != NULL ? &w->previous_task
+                                                         : &w->task;
+  if (done->instance != NULL) {
+    trace_record(s->scheduler_info->trace, *task_instance_id(done->instance),
+                 TRACE_DONE, worker_index);
+    free(done->instance);
+    done->instance = NULL;
+    done->submitter_index = -1;
+  }
+  /* The objects the task sealed are in the local object store now. Plasma
+   * will notify us about them as well, but telling the scheduling algorithm
+   * right away saves a round trip for the tasks that depend on them. */
+  int numa_node = w->numa_node;
+  for (int64_t i = 0; i < num_object_ids; ++i) {
+    handle_object_available(s->scheduler_info, s->scheduler_state,
+                            object_ids[i], numa_node);
+  }
+}
+
+void handle_client_get_task(local_scheduler_state *s, int64_t worker_index) {
+  worker *w =
+      (worker *) utarray_eltptr(s->scheduler_info->workers, worker_index);
+  if (w->busy && w->numa_node >= 0) {
+    s->scheduler_info->numa_stats[w->numa_node].num_busy_workers -= 1;
+  }
+  w->busy = false;
+  handle_worker_available(s->scheduler_info, s->scheduler_state, worker_index);
+}
+
+/**
+ * Mark a task that a worker is executing as canceled in the task log and tell
+ * the worker about it. Workers check for this between steps of their work, so
+ * the worker may still finish the task.
+ *
+ * @param s State of the local scheduler.
+ * @param w The worker.
+ * @param task The task of the worker to cancel.
+ * @return True if the task was canceled, false if there is no such task or it
+ *         was already canceled.
+ */
+bool cancel_worker_task(local_scheduler_state *s,
+                        worker *w,
+                        worker_task *task) {
+  if (task->instance == NULL ||
+      *task_instance_state(task->instance) == TASK_STATUS_CANCELED) {
+    return false;
+  }
+  *task_instance_state(task->instance) = TASK_STATUS_CANCELED;
+  if (s->scheduler_info->db != NULL) {
+    task_log_add_task(s->scheduler_info->db, task->instance);
+  }
+  if (w->sock >= 0) {
+    task_id id = task_spec_id(task_instance_task_spec(task->instance));
+    write_message(w->sock, CANCEL_TASK, sizeof(id), (uint8_t *) &id);
+  }
+  return true;
+}
+
+/**
+ * Find the unfinished task of a worker with the given ID.
+ *
+ * @param w The worker.
+ * @param id The ID of the task.
+ * @return The task, or NULL if the worker has no unfinished task with this ID.
+ */
+worker_task *find_worker_task(worker *w, task_id id) {
+  worker_task *tasks[2] = {&w->task, &w->previous_task};
+  for (int i = 0; i < 2; ++i) {
+    if (tasks[i]->instance == NULL) {
+      continue;
+    }
+    task_id task_id = task_spec_id(task_instance_task_spec(tasks[i]->instance));
+    if (memcmp(&task_id, &id, sizeof(task_id)) == 0) {
+      return tasks[i];
+    }
+  }
+  return NULL;
+}
+
+void handle_client_cancel(local_scheduler_state *s, task_id task_id) {
+  int64_t num_canceled =
+      handle_task_canceled(s->scheduler_info, s->scheduler_state, task_id);
+  /* The task may also be running already, look for it among the unfinished
+   * tasks of every worker. */
+  for (int64_t i = 0; i < utarray_len(s->scheduler_info->workers); ++i) {
+    worker *w = (worker *) utarray_eltptr(s->scheduler_info->workers, i);
+    worker_task *task = find_worker_task(w, task_id);
+    if (task != NULL && cancel_worker_task(s, w, task)) {
+      num_canceled += 1;
+    }
+  }
+  LOG_DEBUG("canceled %" PRId64 " instances of a task", num_canceled);
+}
+
+void handle_client_cancel_all(local_scheduler_state *s, int64_t worker_index) {
+  int64_t num_canceled = handle_client_tasks_canceled(
+      s->scheduler_info, s->scheduler_state, worker_index);
+  for (int64_t i = 0; i < utarray_len(s->scheduler_info->workers); ++i) {
+    worker *w = (worker *) utarray_eltptr(s->scheduler_info->workers, i);
+    if (w->task.submitter_index == worker_index &&
+        cancel_worker_task(s, w, &w->task)) {
+      num_canceled += 1;
+    }
+    if (w->previous_task.submitter_index == worker_index &&
+        cancel_worker_task(s, w, &w->previous_task)) {
+      num_canceled += 1;
+    }
+  }
+  LOG_DEBUG("canceled %" PRId64 " tasks of client %" PRId64, num_canceled,
+            worker_index);
+}
+
+bool worker_task_canceled(local_scheduler_state *s,
+                          int64_t worker_index,
+                          task_id task_id) {
+  worker *w =
+      (worker *) utarray_eltptr(s->scheduler_info->workers, worker_index);
+  worker_task *task = find_worker_task(w, task_id);
+  return task != NULL &&
+         *task_instance_state(task->instance) == TASK_STATUS_CANCELED;
+}
+
+task_spec *take_assigned_task(local_scheduler_state *s, int64_t worker_index) {
+  worker *w =
+      (worker *) utarray_eltptr(s->scheduler_info->workers, worker_index);
+  task_spec *task = w->assigned_task;
+  w->assigned_task = NULL;
+  if (task != NULL) {
+    trace_record(s->scheduler_info->trace,
+                 *task_instance_id(w->task.instance), TRACE_SENT, worker_index);
+  }
+  return task;
 }
 
 void process_message(event_loop *loop, int client_sock, void *context,
@@ -109,32 +693,123 @@ void process_message(event_loop *loop, int client_sock, void *context,
 
   LOG_DEBUG("New event of type %" PRId64, type);
 
+  worker_index *wi;
+  HASH_FIND_INT(s->worker_index, &client_sock, wi);
+  CHECK(wi != NULL);
+
   switch (type) {
   case SUBMIT_TASK: {
     task_spec *spec = (task_spec *) message;
     CHECK(task_size(spec) == length);
-    handle_task_submitted(s->scheduler_info, s->scheduler_state, spec);
+    handle_client_submit(s, wi->worker_index, spec);
   } break;
   case TASK_DONE: {
+    if (length % sizeof(object_id) != 0) {
+      LOG_ERR("ignoring TASK_DONE message of %" PRId64 " bytes", length);
+      break;
+    }
+    handle_client_task_done(s, wi->worker_index, length / sizeof(object_id),
+                            (object_id *) message);
   } break;
   case GET_TASK: {
-    worker_index *wi;
-    HASH_FIND_INT(s->worker_index, &client_sock, wi);
     printf("worker_index is %" PRId64 "\n", wi->worker_index);
-    handle_worker_available(s->scheduler_info, s->scheduler_state,
-                            wi->worker_index);
+    handle_client_get_task(s, wi->worker_index);
   } break;
   case DISCONNECT_CLIENT: {
-    LOG_INFO("Disconnecting client on fd %d", client_sock);
+    worker *w = (worker *) utarray_eltptr(s->scheduler_info->workers,
+                                          wi->worker_index);
+    LOG_INFO("Disconnecting client on fd %d, which was throttled %" PRId64
+             " times",
+             client_sock, w->num_throttled);
+    if (w->throttled) {
+      /* Do not try to grant credits to a client that is gone. */
+      w->throttled = false;
+      s->num_throttled_clients -= 1;
+    }
+    /* The credits of the client will never be used. */
+    s->outstanding_credits -= w->credits;
+    w->credits = 0;
+    w->reclaimed = 0;
+    /* The worker no longer counts towards its NUMA node. */
+    if (w->numa_node >= 0) {
+      numa_stats *stats = &s->scheduler_info->numa_stats[w->numa_node];
+      stats->num_workers -= 1;
+      if (w->busy) {
+        stats->num_busy_workers -= 1;
+      }
+    }
+    w->busy = false;
+    /* Forget the unfinished tasks of the worker, so we do not send
+     * cancellations for them to the closed socket. */
+    free(w->task.instance);
+    free(w->previous_task.instance);
+    w->task = (worker_task){.instance = NULL, .submitter_index = -1};
+    w->previous_task = w->task;
     event_loop_remove_file(loop, client_sock);
   } break;
   case LOG_MESSAGE: {
   } break;
+  case REGISTER_WORKER: {
+    CHECK(length == sizeof(register_worker_info));
+    register_worker(s, wi->worker_index, (register_worker_info *) message);
+  } break;
+  case CANCEL_TASK: {
+    if (length != sizeof(task_id)) {
+      LOG_ERR("ignoring CANCEL_TASK message of %" PRId64 " bytes", length);
+      break;
+    }
+    task_id task_id;
+    memcpy(&task_id, message, sizeof(task_id));
+    handle_client_cancel(s, task_id);
+  } break;
+  case REQUEST_CREDITS: {
+    handle_client_request_credits(s, wi->worker_index);
+  } break;
+  case RETURN_CREDITS: {
+    if (length != sizeof(int64_t)) {
+      LOG_ERR("ignoring RETURN_CREDITS message of %" PRId64 " bytes", length);
+      break;
+    }
+    handle_client_return_credits(s, wi->worker_index, *(int64_t *) message);
+  } break;
+  case CANCEL_CLIENT_TASKS: {
+    handle_client_cancel_all(s, wi->worker_index);
+  } break;
   default:
     /* This code should be unreachable. */
     CHECK(0);
   }
   free(message);
+  /* Tasks may have left the queue, so there may be room to admit more. */
+  if (s->num_throttled_clients > 0) {
+    grant_throttled_clients(s);
+  }
+}
+
+int64_t add_worker(local_scheduler_state *s, int sock) {
+  int64_t index = utarray_len(s->scheduler_info->workers);
+  if (sock >= 0) {
+    /* TODO(pcm): Where shall we free this? */
+    worker_index *new_worker_index = malloc(sizeof(worker_index));
+    new_worker_index->sock = sock;
+    new_worker_index->worker_index = index;
+    HASH_ADD_INT(s->worker_index, sock, new_worker_index);
+  }
+  worker worker = {.sock = sock,
+                   .credits = 0,
+                   .throttled = false,
+                   .num_throttled = 0,
+                   .reclaimed = 0,
+                   .cpu = -1,
+                   .numa_node = -1,
+                   .busy = false,
+                   .task = {.instance = NULL, .submitter_index = -1},
+                   .previous_task = {.instance = NULL, .submitter_index = -1},
+                   .assigned_task = NULL};
+  /* The client asks for submission credits once it wants to submit a task, so
+   * clients that never submit do not hold any. */
+  utarray_push_back(s->scheduler_info->workers, &worker);
+  return index;
 }
 
 void new_client_connection(event_loop *loop, int listener_sock, void *context,
@@ -144,24 +819,50 @@ void new_client_connection(event_loop *loop, int listener_sock, void *context,
   event_loop_add_file(loop, new_socket, EVENT_LOOP_READ, process_message, s);
   LOG_INFO("new connection with fd %d", new_socket);
   /* Add worker to list of workers. */
-  /* TODO(pcm): Where shall we free this? */
-  worker_index *new_worker_index = malloc(sizeof(worker_index));
-  new_worker_index->sock = new_socket;
-  new_worker_index->worker_index = utarray_len(s->scheduler_info->workers);
-  HASH_ADD_INT(s->worker_index, sock, new_worker_index);
-  worker worker = {.sock = new_socket};
-  utarray_push_back(s->scheduler_info->workers, &worker);
+  add_worker(s, new_socket);
 }
 
+/* The rest of this file is the standalone local scheduler process. It is
+ * left out when the scheduler is built as a library for embedding. */
+#ifndef PHOTON_LIBRARY
+
 /* We need this code so we can clean up when we get a SIGTERM signal. */
 
+/** How often we check whether we were asked to shut down with SIGTERM. */
+#define SHUTDOWN_CHECK_INTERVAL_MS 100
+
 local_scheduler_state *g_state;
 
+/** Set by the SIGTERM handler to request a shutdown. */
+volatile sig_atomic_t shutdown_requested = 0;
+
 void signal_handler(int signal) {
+  /* Exporting the trace and writing the snapshot do I/O and may find the
+   * scheduler state in the middle of an update, so leave them to the event
+   * loop. */
+  if (signal == SIGUSR1) {
+    trace_export_requested = 1;
+  }
   if (signal == SIGTERM) {
-    free_local_scheduler(g_state);
-    exit(0);
+    shutdown_requested = 1;
+  }
+}
+
+int64_t shutdown_timer_handler(event_loop *loop,
+                               int64_t timer_id,
+                               void *context) {
+  if (!shutdown_requested) {
+    return SHUTDOWN_CHECK_INTERVAL_MS;
+  }
+  local_scheduler_state *s = context;
+  if (s->snapshot_path != NULL) {
+    snapshot_local_scheduler(s);
   }
+  if (s->trace_path != NULL) {
+    export_trace(s);
+  }
+  free_local_scheduler(s);
+  exit(0);
 }
 
 /* End of the cleanup code. */
@@ -169,28 +870,45 @@ void signal_handler(int signal) {
 void start_server(const char *socket_name,
                   const char *redis_addr,
                   int redis_port,
-                  const char *plasma_socket_name) {
+                  const char *plasma_socket_name,
+                  const char *snapshot_path,
+                  int64_t max_credits,
+                  int64_t max_queue_length,
+                  const char *trace_path,
+                  int64_t trace_sample_rate) {
   int fd = bind_ipc_sock(socket_name);
   event_loop *loop = event_loop_create();
-  g_state =
-      init_local_scheduler(loop, redis_addr, redis_port, plasma_socket_name);
+  g_state = init_local_scheduler(
+      loop, redis_addr, redis_port, plasma_socket_name, snapshot_path,
+      max_credits, max_queue_length, trace_path, trace_sample_rate);
 
   /* Run event loop. */
   event_loop_add_file(loop, fd, EVENT_LOOP_READ, new_client_connection,
                       g_state);
+  event_loop_add_timer(loop, SHUTDOWN_CHECK_INTERVAL_MS, shutdown_timer_handler,
+                       g_state);
   event_loop_run(loop);
 }
 
 int main(int argc, char *argv[]) {
   signal(SIGTERM, signal_handler);
+  signal(SIGUSR1, signal_handler);
   /* Path of the listening socket of the local scheduler. */
   char *scheduler_socket_name = NULL;
   /* IP address and port of redis. */
   char *redis_addr_port = NULL;
   /* Socket name for the local Plasma store. */
   char *plasma_socket_name = NULL;
+  /* Path of the file that the scheduler state is snapshotted to. */
+  char *snapshot_path = NULL;
+  /* The maximum number of credits per client and the maximum queue length. */
+  int64_t max_credits = DEFAULT_MAX_CREDITS;
+  int64_t max_queue_length = DEFAULT_MAX_QUEUE_LENGTH;
+  /* Path the task trace is exported to, and which share of tasks to trace. */
+  char *trace_path = NULL;
+  int64_t trace_sample_rate = 1;
   int c;
-  while ((c = getopt(argc, argv, "s:r:p:")) != -1) {
+  while ((c = getopt(argc, argv, "s:r:p:c:q:Q:t:T:")) != -1) {
     switch (c) {
     case 's':
       scheduler_socket_name = optarg;
@@ -201,6 +919,21 @@ int main(int argc, char *argv[]) {
     case 'p':
       plasma_socket_name = optarg;
       break;
+    case 'c':
+      snapshot_path = optarg;
+      break;
+    case 'q':
+      max_credits = atoll(optarg);
+      break;
+    case 'Q':
+      max_queue_length = atoll(optarg);
+      break;
+    case 't':
+      trace_path = optarg;
+      break;
+    case 'T':
+      trace_sample_rate = atoll(optarg);
+      break;
     default:
       LOG_ERR("unknown option %c", c);
       exit(-1);
@@ -214,15 +947,23 @@ int main(int argc, char *argv[]) {
     LOG_ERR("please specify socket for connecting to Plasma with -p switch");
     exit(-1);
   }
-  /* Parse the Redis address into an IP address and a port. */
+  /* Parse the Redis address into an IP address and a port. Redis is optional,
+   * without it tasks are not added to the task log. */
   char redis_addr[16] = {0};
   char redis_port[6] = {0};
-  if (!redis_addr_port ||
+  if (redis_addr_port &&
       sscanf(redis_addr_port, "%15[0-9.]:%5[0-9]", redis_addr, redis_port) !=
           2) {
     LOG_ERR("need to specify redis address like 127.0.0.1:6379 with -r switch");
     exit(-1);
   }
-  start_server(scheduler_socket_name, &redis_addr[0], atoi(redis_port),
-               plasma_socket_name);
+  if (trace_sample_rate < 1) {
+    LOG_ERR("the trace sample rate given with -T must be at least 1");
+    exit(-1);
+  }
+  start_server(scheduler_socket_name, redis_addr_port ? &redis_addr[0] : NULL,
+               atoi(redis_port), plasma_socket_name, snapshot_path,
+               max_credits, max_queue_length, trace_path, trace_sample_rate);
 }
+
+#endif /* PHOTON_LIBRARY */
@@ -6,6 +6,133 @@
 
 typedef struct local_scheduler_state local_scheduler_state;
 
+/**
+ * Initialize the local scheduler.
+ *
+ * @param loop Event loop of the local scheduler.
+ * @param redis_addr The IP address of Redis, or NULL to run without the task
+ *        log.
+ * @param redis_port The port of Redis.
+ * @param plasma_socket_name The socket of the local Plasma store, or NULL to
+ *        learn about local objects only from TASK_DONE.
+ * @param snapshot_path The path of the snapshot file, or NULL to disable
+ *        snapshots. The journal of the changes since the snapshot is kept
+ *        next to it, with ".log" appended to the path.
+ * @param max_credits The maximum number of submission credits per client.
+ * @param max_queue_length The queue length at which no more credits are
+ *        granted.
+ * @param trace_path The path the task trace is exported to, or NULL to disable
+ *        tracing.
+ * @param trace_sample_rate Only one in trace_sample_rate tasks are traced.
+ * @return State of the local scheduler.
+ */
+local_scheduler_state *init_local_scheduler(event_loop *loop,
+                                            const char *redis_addr,
+                                            int redis_port,
+                                            const char *plasma_socket_name,
+                                            const char *snapshot_path,
+                                            int64_t max_credits,
+                                            int64_t max_queue_length,
+                                            const char *trace_path,
+                                            int64_t trace_sample_rate);
+
+/**
+ * Free the local scheduler and its event loop.
+ *
+ * @param s State of the local scheduler.
+ * @return Void.
+ */
+void free_local_scheduler(local_scheduler_state *s);
+
+/**
+ * Add a client to the worker table.
+ *
+ * @param s State of the local scheduler.
+ * @param sock The socket of the client, or -1 for a client in this process.
+ * @return The index of the client in scheduler_info->workers.
+ */
+int64_t add_worker(local_scheduler_state *s, int sock);
+
+/**
+ * Process a task submitted by a client.
+ *
+ * @param s State of the local scheduler.
+ * @param worker_index The index of the submitting client.
+ * @param spec The task. This is copied, so it can be freed afterwards.
+ * @return Void.
+ */
+void handle_client_submit(local_scheduler_state *s,
+                          int64_t worker_index,
+                          task_spec *spec);
+
+/**
+ * Process a worker reporting that it has finished its task.
+ *
+ * @param s State of the local scheduler.
+ * @param worker_index The index of the worker.
+ * @param num_object_ids The number of objects the task sealed.
+ * @param object_ids The IDs of the objects the task sealed.
+ * @return Void.
+ */
+void handle_client_task_done(local_scheduler_state *s,
+                             int64_t worker_index,
+                             int64_t num_object_ids,
+                             object_id *object_ids);
+
+/**
+ * Process a worker asking for a task. The task is sent to the worker right
+ * away if there is a runnable one, otherwise once one becomes runnable.
+ *
+ * @param s State of the local scheduler.
+ * @param worker_index The index of the worker.
+ * @return Void.
+ */
+void handle_client_get_task(local_scheduler_state *s, int64_t worker_index);
+
+/**
+ * Process a client canceling a task. Queued instances of the task are removed
+ * from the task queue, and workers that are executing the task are told that
+ * it was canceled.
+ *
+ * @param s State of the local scheduler.
+ * @param task_id The ID of the task to cancel.
+ * @return Void.
+ */
+void handle_client_cancel(local_scheduler_state *s, task_id task_id);
+
+/**
+ * Process a client canceling all tasks it submitted, both queued and running
+ * ones.
+ *
+ * @param s State of the local scheduler.
+ * @param worker_index The index of the client.
+ * @return Void.
+ */
+void handle_client_cancel_all(local_scheduler_state *s, int64_t worker_index);
+
+/**
+ * Check whether a task that a worker is executing has been canceled.
+ *
+ * @param s State of the local scheduler.
+ * @param worker_index The index of the worker.
+ * @param task_id The ID of the task.
+ * @return True if the task was canceled. This is false once the worker
+ *         reported the task as done.
+ */
+bool worker_task_canceled(local_scheduler_state *s,
+                          int64_t worker_index,
+                          task_id task_id);
+
+/**
+ * Take the task that was assigned to an in-process worker.
+ *
+ * @param s State of the local scheduler.
+ * @param worker_index The index of the worker.
+ * @return The task, which must be freed by the caller, or NULL if no task has
+ *         been assigned to the worker yet.
+ */
+task_spec *take_assigned_task(local_scheduler_state *s, int64_t worker_index);
+
 /**
  * Establish a connection to a new client.
  *
@@ -34,6 +161,119 @@ void assign_task_to_worker(scheduler_info *info,
                            task_spec *task,
                            int worker_index);
 
+/**
+ * Grant submission credits to a client, based on how full the task queue is.
+ * While other clients are throttled, clients that still hold credits are not
+ * topped up.
+ *
+ * @param s State of the local scheduler.
+ * @param worker_index The index of the client in scheduler_info->workers.
+ * @return True if credits were granted.
+ */
+bool grant_credits(local_scheduler_state *s, int64_t worker_index);
+
+/**
+ * Take back the credits of all clients except one. This is done when a client
+ * has to wait for credits, so that idle clients cannot keep the room in the
+ * task queue to themselves. The credits can be granted to others right away,
+ * and the clients are told with RECLAIM_CREDITS to stop using them.
+ *
+ * @param s State of the local scheduler.
+ * @param worker_index The index of the client that waits for credits.
+ * @return Void.
+ */
+void reclaim_credits(local_scheduler_state *s, int64_t worker_index);
+
+/**
+ * Process a client asking for submission credits because it ran out. If the
+ * queue is too full to grant any, the client is marked as throttled, told so
+ * with a grant of zero credits, and revisited once there is room again.
+ *
+ * @param s State of the local scheduler.
+ * @param worker_index The index of the client in scheduler_info->workers.
+ * @return Void.
+ */
+void handle_client_request_credits(local_scheduler_state *s,
+                                   int64_t worker_index);
+
+/**
+ * Process a client answering RECLAIM_CREDITS. From now on, the client does not
+ * use the credits we took back.
+ *
+ * @param s State of the local scheduler.
+ * @param worker_index The index of the client in scheduler_info->workers.
+ * @param credits The number of credits the client still held.
+ * @return Void.
+ */
+void handle_client_return_credits(local_scheduler_state *s,
+                                  int64_t worker_index,
+                                  int64_t credits);
+
+/**
+ * Grant submission credits to all throttled clients if there is room in the
+ * task queue.
+ *
+ * @param s State of the local scheduler.
+ * @return Void.
+ */
+void grant_throttled_clients(local_scheduler_state *s);
+
+/**
+ * Pin a worker to a CPU and record the NUMA node it runs on. The scheduling
+ * algorithm uses this to place tasks near their inputs.
+ *
+ * @param s State of the local scheduler.
+ * @param worker_index The index of the worker in scheduler_info->workers.
+ * @param info The CPU requested by the worker.
+ * @return Void.
+ */
+void register_worker(local_scheduler_state *s,
+                     int64_t worker_index,
+                     register_worker_info *info);
+
+/**
+ * Log the utilization statistics of each NUMA node.
+ *
+ * @param s State of the local scheduler.
+ * @return Void.
+ */
+void log_numa_stats(local_scheduler_state *s);
+
+/**
+ * This is the timer callback that periodically logs the utilization
+ * statistics of each NUMA node.
+ *
+ * @param loop The local scheduler's event loop.
+ * @param timer_id The ID of the timer.
+ * @param context The local scheduler state.
+ * @return The number of milliseconds until the timer fires again.
+ */
+int64_t numa_stats_timer_handler(event_loop *loop,
+                                 int64_t timer_id,
+                                 void *context);
+
+/**
+ * Write the task lifecycle trace to the trace file in the Chrome trace event
+ * format.
+ *
+ * @param s State of the local scheduler.
+ * @return Void.
+ */
+void export_trace(local_scheduler_state *s);
+
+/**
+ * This is the timer callback that exports the trace after it was requested by
+ * sending SIGUSR1 to the local scheduler.
+ *
+ * @param loop The local scheduler's event loop.
+ * @param timer_id The ID of the timer.
+ * @param context The local scheduler state.
+ * @return The number of milliseconds until the timer fires again.
+ */
+int64_t trace_timer_handler(event_loop *loop,
+                            int64_t timer_id,
+                            void *context);
+
 /**
  * This is the callback that is used to process a notification from the Plasma
  * store that an object has been sealed.
@@ -49,4 +289,46 @@ void process_plasma_notification(event_loop *loop,
                                  void *context,
                                  int events);
 
+/**
+ * Write a new snapshot of the queued tasks and start a new, empty journal.
+ *
+ * @param s State of the local scheduler.
+ * @return Void.
+ */
+void compact_snapshot(local_scheduler_state *s);
+
+/**
+ * Append the changes to the queued tasks since the last call to the journal
+ * file. Once the journal is larger than the
+ * snapshot, this writes a new snapshot with compact_snapshot instead.
+ *
+ * @param s State of the local scheduler.
+ * @return Void.
+ */
+void snapshot_local_scheduler(local_scheduler_state *s);
+
+/**
+ * Reload the queued tasks from the snapshot file and its journal, if there is
+ * one, and ask the local Plasma store which of their inputs are available.
+ * Workers reattach by connecting to the scheduler socket again with a new
+ * client.
+ *
+ * @param s State of the local scheduler.
+ * @return Void.
+ */
+void restore_local_scheduler(local_scheduler_state *s);
+
+/**
+ * This is the timer callback that periodically journals the changes to the
+ * state of the local scheduler.
+ *
+ * @param loop The local scheduler's event loop.
+ * @param timer_id The ID of the timer.
+ * @param context The local scheduler state.
+ * @return The number of milliseconds until the timer fires again.
+ */
+int64_t snapshot_timer_handler(event_loop *loop,
+                               int64_t timer_id,
+                               void *context);
+
 #endif /* PHOTON_SCHEDULER_H */
@@ -0,0 +1,144 @@
+#include "photon_trace.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+  /** The ID of the task instance. */
+  task_iid task_iid;
+  /** Time in microseconds at which the stage was reached. */
+  int64_t timestamp;
+  /** The stage that was reached. */
+  int32_t stage;
+  /** The index of the worker involved, or -1. */
+  int32_t worker_index;
+} trace_event;
+
+struct trace_buffer {
+  /** The ring of records. */
+  trace_event *events;
+  /** The number of records in the ring. */
+  int64_t capacity;
+  /** Only one in sample_rate task instances are traced. */
+  int64_t sample_rate;
+  /** The total number of records that were ever written. The next record
+   *  goes to index next % capacity. */
+  int64_t next;
+};
+
+/** Names of the spans that start at each stage. */
+static const char *trace_span_names[] = {
+    "submit", "wait_dependencies", "wait_worker", "dispatch", "execute"};
+
+trace_buffer *make_trace_buffer(int64_t capacity, int64_t sample_rate) {
+  CHECK(capacity > 0 && sample_rate > 0);
+  trace_buffer *buffer = malloc(sizeof(trace_buffer));
+  buffer->events = calloc(capacity, sizeof(trace_event));
+  buffer->capacity = capacity;
+  buffer->sample_rate = sample_rate;
+  buffer->next = 0;
+  return buffer;
+}
+
+void free_trace_buffer(trace_buffer *buffer) {
+  free(buffer->events);
+  free(buffer);
+}
+
+bool trace_sampled(trace_buffer *buffer, task_iid task_iid) {
+  if (buffer == NULL) {
+    return false;
+  }
+  /* Task instance IDs are random, so sampling on their first bytes gives a
+   * uniform sample and keeps all stages of a sampled instance. */
+  uint32_t hash;
+  memcpy(&hash, task_iid.id, sizeof(hash));
+  return hash % buffer->sample_rate == 0;
+}
+
+void trace_record(trace_buffer *buffer,
+                  task_iid task_iid,
+                  trace_stage stage,
+                  int worker_index) {
+  if (!trace_sampled(buffer, task_iid)) {
+    return;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  /* Claim a slot with an atomic increment, so that concurrent writers never
+   * write the same record. */
+  int64_t index = __sync_fetch_and_add(&buffer->next, 1) % buffer->capacity;
+  trace_event *event = &buffer->events[index];
+  event->task_iid = task_iid;
+  event->timestamp = (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+  event->stage = stage;
+  event->worker_index = worker_index;
+}
+
+/**
+ * Order trace events by task instance and then by time.
+ */
+static int compare_trace_events(const void *a, const void *b) {
+  const trace_event *event_a = a;
+  const trace_event *event_b = b;
+  int result = memcmp(&event_a->task_iid, &event_b->task_iid, sizeof(task_iid));
+  if (result != 0) {
+    return result;
+  }
+  if (event_a->timestamp != event_b->timestamp) {
+    return event_a->timestamp < event_b->timestamp ? -1 : 1;
+  }
+  return event_a->stage - event_b->stage;
+}
+
+bool trace_export(trace_buffer *buffer, const char *path) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    return false;
+  }
+  /* Sort a copy of the records, so that the ring keeps its order. The caller
+   * makes sure that no records are written meanwhile, because we could copy a
+   * half-written record otherwise. */
+  int64_t num_events =
+      buffer->next < buffer->capacity ? buffer->next : buffer->capacity;
+  trace_event *events = malloc(num_events * sizeof(trace_event));
+  memcpy(events, buffer->events, num_events * sizeof(trace_event));
+  qsort(events, num_events, sizeof(trace_event), compare_trace_events);
+  fprintf(file, "{\"traceEvents\": [");
+  bool first = true;
+  for (int64_t i = 0; i + 1 < num_events; ++i) {
+    trace_event *event = &events[i];
+    trace_event *next_event = &events[i + 1];
+    if (memcmp(&event->task_iid, &next_event->task_iid, sizeof(task_iid)) !=
+            0 ||
+        event->stage >= TRACE_DONE) {
+      /* This is the last record we have of this task instance. */
+      continue;
+    }
+    char hex[2 * UNIQUE_ID_SIZE + 1];
+    for (int j = 0; j < UNIQUE_ID_SIZE; ++j) {
+      snprintf(&hex[2 * j], 3, "%02x", event->task_iid.id[j]);
+    }
+    /* Show each stage as an async span, because the spans of different task
+     * instances overlap. */
+    const char *name = trace_span_names[event->stage];
+    int worker_index = event->worker_index >= 0 ? event->worker_index
+                                                : next_event->worker_index;
+    fprintf(file,
+            "%s\n{\"name\": \"%s\", \"cat\": \"task\", \"ph\": \"b\", "
+            "\"id\": \"0x%s\", \"pid\": 0, \"tid\": 0, \"ts\": %" PRId64
+            ", \"args\": {\"worker_index\": %d}},",
+            first ? "" : ",", name, hex, event->timestamp, worker_index);
+    fprintf(file,
+            "\n{\"name\": \"%s\", \"cat\": \"task\", \"ph\": \"e\", "
+            "\"id\": \"0x%s\", \"pid\": 0, \"tid\": 0, \"ts\": %" PRId64 "}",
+            name, hex, next_event->timestamp);
+    first = false;
+  }
+  fprintf(file, "\n]}\n");
+  free(events);
+  return fclose(file) == 0;
+}
@@ -0,0 +1,95 @@
+#ifndef PHOTON_TRACE_H
+#define PHOTON_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common/task.h"
+
+/* ==== Task lifecycle tracing ====
+ *
+ * The local scheduler can record when each task instance passes through the
+ * stages of its lifecycle. Records go to a fixed size ring buffer, so
+ * tracing never allocates memory on the scheduling path. Old records are
+ * overwritten when the buffer is full. The buffer can be exported in the
+ * Chrome trace event format and viewed in chrome://tracing.
+ *
+ */
+
+/** The stages of the lifecycle of a task instance. */
+typedef enum {
+  /** The local scheduler received the task. */
+  TRACE_SUBMITTED,
+  /** The task was added to the task queue. */
+  TRACE_QUEUED,
+  /** All dependencies of the task are available locally. If they already
+   *  were when the task was submitted, this is recorded right away. */
+  TRACE_RUNNABLE,
+  /** The task was assigned to a worker. */
+  TRACE_DISPATCHED,
+  /** The EXECUTE_TASK message was written to the worker's socket, or an
+   *  in-process worker took the task. */
+  TRACE_SENT,
+  /** The worker reported that the task is done. */
+  TRACE_DONE,
+} trace_stage;
+
+typedef struct trace_buffer trace_buffer;
+
+/**
+ * Create a trace buffer.
+ *
+ * @param capacity The number of records the buffer holds.
+ * @param sample_rate Only one in sample_rate task instances are traced.
+ * @return The trace buffer.
+ */
+trace_buffer *make_trace_buffer(int64_t capacity, int64_t sample_rate);
+
+/**
+ * Free a trace buffer.
+ *
+ * @param buffer The trace buffer.
+ * @return Void.
+ */
+void free_trace_buffer(trace_buffer *buffer);
+
+/**
+ * Check whether a task instance is traced. The decision only depends on the
+ * task instance ID, so it is the same for all stages of an instance.
+ *
+ * @param buffer The trace buffer, or NULL if tracing is disabled.
+ * @param task_iid The ID of the task instance.
+ * @return True if the stages of the task instance are recorded.
+ */
+bool trace_sampled(trace_buffer *buffer, task_iid task_iid);
+
+/**
+ * Record that a task instance reached a stage of its lifecycle. This does
+ * nothing if the task instance is not sampled. Recording does not take a lock,
+ * so it is safe to call from several threads, but not while trace_export runs.
+ *
+ * @param buffer The trace buffer, or NULL if tracing is disabled.
+ * @param task_iid The ID of the task instance.
+ * @param stage The stage the task instance reached.
+ * @param worker_index The index of the worker involved, or -1.
+ * @return Void.
+ */
+void trace_record(trace_buffer *buffer,
+                  task_iid task_iid,
+                  trace_stage stage,
+                  int worker_index);
+
+/**
+ * Write the records in the trace buffer to a file in the Chrome trace event
+ * format. Each stage of each task instance is shown as a span that lasts
+ * until the task instance reached its next stage. No records may be written
+ * while this runs. The local scheduler ensures this by recording and exporting
+ * on its event loop thread only.
+ *
+ * @param buffer The trace buffer.
+ * @param path The path of the file to write.
+ * @return True if the file was written successfully.
+ */
+bool trace_export(trace_buffer *buffer, const char *path);
+
+#endif /* PHOTON_TRACE_H */
@@ -1,19 +1,83 @@
 from __future__ import print_function
 
+import json
 import os
 import signal
+import struct
 import subprocess
 import sys
+import tempfile
 import unittest
 import random
+import select
 import threading
 import time
 
 import photon
+import photon_async
+import photon_embedded
 import plasma
 
 USE_VALGRIND = False
 
+class Future(object):
+  """A minimal future with the interface photon_async needs."""
+
+  def __init__(self):
+    self._done = False
+    self._result = None
+    self._callbacks = []
+
+  def done(self):
+    return self._done
+
+  def cancelled(self):
+    return False
+
+  def result(self):
+    return self._result
+
+  def set_result(self, result):
+    self._done = True
+    self._result = result
+    for callback in self._callbacks:
+      callback(self)
+
+  def add_done_callback(self, callback):
+    self._callbacks.append(callback)
+
+class SelectLoop(object):
+  """A minimal event loop with the interface photon_async needs."""
+
+  def __init__(self):
+    self.readers = {}
+    self.timers = []
+
+  def create_future(self):
+    return Future()
+
+  def add_reader(self, fd, callback):
+    self.readers[fd] = callback
+
+  def remove_reader(self, fd):
+    del self.readers[fd]
+
+  def call_later(self, delay, callback):
+    self.timers.append((time.time() + delay, callback))
+
+  def run_until_complete(self, future, timeout=5.0):
+    deadline = time.time() + timeout
+    while not future.done() and time.time() < deadline:
+      readable, _, _ = select.select(list(self.readers.keys()), [], [], 0.001)
+      for fd in readable:
+        self.readers[fd]()
+      now = time.time()
+      timers = [timer for timer in self.timers if timer[0] <= now]
+      self.timers = [timer for timer in self.timers if timer[0] > now]
+      for _, callback in timers:
+        callback()
+    return future.result()
+
 class TestPhotonClient(unittest.TestCase):
 
   def setUp(self):
@@ -26,19 +90,26 @@ class TestPhotonClient(unittest.TestCase):
     self.p2 = subprocess.Popen([plasma_executable, "-s", plasma_socket])
     time.sleep(0.1)
     self.plasma_client = plasma.PlasmaClient(plasma_socket)
+    self.scheduler_name = "/tmp/scheduler{}".format(random.randint(0, 10000))
+    self.snapshot_path = "/tmp/scheduler_snapshot{}".format(random.randint(0, 10000))
+    self.start_scheduler(plasma_socket)
+    # Connect to the scheduler.
+    self.photon_client = photon.PhotonClient(self.scheduler_name)
+    # TODO(rkn): This should be a FunctionID.
+    self.function_id = photon.ObjectID(20 * "a")
+
+  def start_scheduler(self, plasma_socket, extra_args=[], stderr=None):
+    self.plasma_socket = plasma_socket
     scheduler_executable = os.path.join(os.path.abspath(os.path.dirname(__file__)), "../build/photon_scheduler")
-    scheduler_name = "/tmp/scheduler{}".format(random.randint(0, 10000))
-    command = [scheduler_executable, "-s", scheduler_name, "-r", "127.0.0.1:6379", "-p", plasma_socket]
+    command = [scheduler_executable, "-s", self.scheduler_name, "-r", "127.0.0.1:6379", "-p", plasma_socket] + extra_args
     if USE_VALGRIND:
-      self.p3 = subprocess.Popen(["valgrind", "--track-origins=yes", "--leak-check=full", "--show-leak-kinds=all"] + command)
+      self.p3 = subprocess.Popen(["valgrind", "--track-origins=yes", "--leak-check=full", "--show-leak-kinds=all"] + command, stderr=stderr)
     else:
-      self.p3 = subprocess.Popen(command)
+      self.p3 = subprocess.Popen(command, stderr=stderr)
     if USE_VALGRIND:
       time.sleep(1.0)
     else:
       time.sleep(0.1)
-    # Connect to the scheduler.
-    self.photon_client = photon.PhotonClient(scheduler_name)
 
   def tearDown(self):
     # Kill the Redis server.
@@ -50,12 +121,30 @@ class TestPhotonClient(unittest.TestCase):
       self.p3.send_signal(signal.SIGTERM)
       self.p3.wait()
       os._exit(self.p3.returncode)
-    else:
+    elif self.p3.poll() is None:
       self.p3.kill()
+    for path in [self.snapshot_path, self.snapshot_path + ".log"]:
+      if os.path.exists(path):
+        os.remove(path)
+
+  def wait_for_task(self):
+    # Poll for a task that was requested with request_task, or return None if
+    # none arrives within a second.
+    for _ in range(1000):
+      task = self.photon_client.poll_task()
+      if task is not None:
+        return task
+      time.sleep(0.001)
+    return None
+
+  def wait_until_canceled(self, task):
+    for _ in range(1000):
+      if self.photon_client.task_canceled(task):
+        return True
+      time.sleep(0.001)
+    return False
 
   def test_submit_and_get_task(self):
-    # TODO(rkn): This should be a FunctionID.
-    function_id = photon.ObjectID(20 * "a")
     object_ids = [photon.ObjectID(20 * chr(i)) for i in range(256)]
     # Create and seal the objects in the object store so that we can schedule
     # all of the subsequent tasks.
@@ -94,7 +183,7 @@ class TestPhotonClient(unittest.TestCase):
 
     for args in args_list:
       for num_return_vals in [0, 1, 2, 3, 5, 10, 100]:
-        task = photon.Task(function_id, args, num_return_vals)
+        task = photon.Task(self.function_id, args, num_return_vals)
         # Submit a task.
         self.photon_client.submit(task)
         # Get the task.
@@ -113,19 +202,89 @@ class TestPhotonClient(unittest.TestCase):
     # Submit all of the tasks.
     for args in args_list:
       for num_return_vals in [0, 1, 2, 3, 5, 10, 100]:
-        task = photon.Task(function_id, args, num_return_vals)
+        task = photon.Task(self.function_id, args, num_return_vals)
         self.photon_client.submit(task)
     # Get all of the tasks.
     for args in args_list:
       for num_return_vals in [0, 1, 2, 3, 5, 10, 100]:
         new_task = self.photon_client.get_task()
 
+  def test_submit_batch_and_poll_task(self):
+    tasks = [photon.Task(self.function_id, [i], 1) for i in range(10)]
+    self.photon_client.submit_batch(tasks)
+    # Nothing has been requested yet, so there is nothing to poll.
+    self.assertIsNone(self.photon_client.poll_task())
+    for task in tasks:
+      self.photon_client.request_task()
+      new_task = self.wait_for_task()
+      self.assertIsNotNone(new_task)
+      self.assertEqual(task.arguments(), new_task.arguments())
+
+  def test_submit_from_two_threads(self):
+    num_tasks = 100
+    def submit(thread_index):
+      for i in range(num_tasks):
+        self.photon_client.submit(photon.Task(self.function_id, [thread_index, i], 0))
+    threads = [threading.Thread(target=submit, args=(j,)) for j in range(2)]
+    for t in threads:
+      t.start()
+    for t in threads:
+      t.join()
+    # Every task arrives intact, so the messages were not interleaved.
+    arguments = set()
+    for _ in range(2 * num_tasks):
+      arguments.add(tuple(self.photon_client.get_task().arguments()))
+    self.assertEqual(arguments, set((j, i) for j in range(2) for i in range(num_tasks)))
+
+  def test_async_get_task(self):
+    loop = SelectLoop()
+    task = photon.Task(self.function_id, [1], 0)
+    self.photon_client.submit(task)
+    new_task = loop.run_until_complete(photon_async.get_task(self.photon_client, loop))
+    self.assertEqual(task.arguments(), new_task.arguments())
+    # Let another call on the client read the task from the socket after we
+    # started waiting for it. The future must resolve nevertheless.
+    future = photon_async.get_task(self.photon_client, loop)
+    task = photon.Task(self.function_id, [2], 0)
+    self.photon_client.submit(task)
+    time.sleep(0.1)
+    self.photon_client.task_canceled(task)
+    new_task = loop.run_until_complete(future)
+    self.assertEqual(task.arguments(), new_task.arguments())
+    # The task was requested only once, so the local scheduler is still happy
+    # to serve us.
+    task = photon.Task(self.function_id, [3], 0)
+    self.photon_client.submit(task)
+    self.assertEqual(task.arguments(), self.photon_client.get_task().arguments())
+
+  def test_async_submit(self):
+    # Restart the scheduler so that it admits at most five queued tasks.
+    self.p3.kill()
+    self.p3.wait()
+    self.start_scheduler(self.plasma_socket, ["-Q", "5"])
+    self.photon_client = photon.PhotonClient(self.scheduler_name)
+    worker = photon.PhotonClient(self.scheduler_name)
+    loop = SelectLoop()
+    object_id = photon.ObjectID(20 * chr(9))
+    # These tasks stay queued because their argument is not available.
+    task = photon.Task(self.function_id, [object_id], 0)
+    for _ in range(5):
+      future = photon_async.submit(self.photon_client, task, loop)
+      self.assertTrue(loop.run_until_complete(future))
+    # The queue is full, so the next submission waits without blocking.
+    future = photon_async.submit(self.photon_client, task, loop)
+    loop.run_until_complete(future, timeout=0.1)
+    self.assertFalse(future.done())
+    # Once a task leaves the queue, the submission goes through.
+    self.plasma_client.create(object_id.id(), 0)
+    self.plasma_client.seal(object_id.id())
+    worker.get_task()
+    self.assertTrue(loop.run_until_complete(future))
+
   def test_scheduling_when_objects_ready(self):
     # Create a task and submit it.
     object_id = photon.ObjectID(20 * chr(0))
-    # TODO(rkn): This should be a FunctionID.
-    function_id = photon.ObjectID(20 * "a")
-    task = photon.Task(function_id, [object_id], 0)
+    task = photon.Task(self.function_id, [object_id], 0)
     self.photon_client.submit(task)
     # Launch a thread to get the task.
     def get_task():
@@ -141,6 +300,446 @@ class TestPhotonClient(unittest.TestCase):
     # Wait until the thread finishes so that we know the task was scheduled.
     t.join()
 
+  def test_task_done_releases_dependencies(self):
+    object_id = photon.ObjectID(20 * chr(2))
+    task = photon.Task(self.function_id, [object_id], 0)
+    self.photon_client.submit(task)
+    self.photon_client.request_task()
+    time.sleep(0.1)
+    # The object is not available yet, so the task cannot be scheduled.
+    self.assertIsNone(self.photon_client.poll_task())
+    # Report the object as sealed by a finished task without going through
+    # Plasma. This should trigger a scheduling event.
+    self.photon_client.task_done([object_id])
+    new_task = self.wait_for_task()
+    self.assertIsNotNone(new_task)
+    self.assertEqual(object_id.id(), new_task.arguments()[0].id())
+
+  def test_task_done_then_plasma_seal(self):
+    object_id = photon.ObjectID(20 * chr(10))
+    task = photon.Task(self.function_id, [object_id], 0)
+    self.photon_client.submit(task)
+    self.photon_client.request_task()
+    self.photon_client.task_done([object_id])
+    new_task = self.wait_for_task()
+    self.assertIsNotNone(new_task)
+    self.assertEqual(object_id.id(), new_task.arguments()[0].id())
+    # Plasma announces the object that the worker already reported. The
+    # scheduler knows about it, so nothing is dispatched a second time.
+    self.photon_client.request_task()
+    self.plasma_client.create(object_id.id(), 0)
+    self.plasma_client.seal(object_id.id())
+    self.assertIsNone(self.wait_for_task())
+
+  def test_cancel_task(self):
+    object_id = photon.ObjectID(20 * chr(6))
+    canceled_task = photon.Task(self.function_id, [object_id], 0)
+    task = photon.Task(self.function_id, [object_id, object_id], 0)
+    # Both tasks wait for the object, so they are queued.
+    self.photon_client.submit(canceled_task)
+    self.photon_client.submit(task)
+    self.photon_client.cancel(canceled_task)
+    self.photon_client.request_task()
+    self.photon_client.task_done([object_id])
+    new_task = self.wait_for_task()
+    # Only the task that was not canceled is scheduled.
+    self.assertIsNotNone(new_task)
+    self.assertEqual(2, len(new_task.arguments()))
+    self.assertFalse(self.photon_client.task_canceled(new_task))
+    self.photon_client.request_task()
+    time.sleep(0.1)
+    self.assertIsNone(self.photon_client.poll_task())
+
+  def test_cancel_running_task(self):
+    task = photon.Task(self.function_id, [1], 0)
+    self.photon_client.submit(task)
+    running_task = self.photon_client.get_task()
+    self.assertFalse(self.photon_client.task_canceled(running_task))
+    self.photon_client.cancel(task)
+    self.assertTrue(self.wait_until_canceled(running_task))
+    # Once the task is done, we no longer keep track of it.
+    self.photon_client.task_done([])
+    self.assertFalse(self.photon_client.task_canceled(running_task))
+
+  def test_cancel_running_task_with_prefetch(self):
+    first_task = photon.Task(self.function_id, [1], 0)
+    second_task = photon.Task(self.function_id, [2], 0)
+    third_task = photon.Task(self.function_id, [3], 0)
+    self.photon_client.submit(first_task)
+    self.photon_client.get_task()
+    self.photon_client.cancel(first_task)
+    self.assertTrue(self.wait_until_canceled(first_task))
+    # Getting the next task before the first one is done must neither forget
+    # the cancellation of the first task nor apply it to the second one.
+    self.photon_client.request_task()
+    self.photon_client.submit(second_task)
+    new_task = self.wait_for_task()
+    self.assertEqual(second_task.arguments(), new_task.arguments())
+    self.assertTrue(self.photon_client.task_canceled(first_task))
+    self.assertFalse(self.photon_client.task_canceled(second_task))
+    # The second task can be canceled while the first one still runs.
+    self.photon_client.cancel(second_task)
+    self.assertTrue(self.wait_until_canceled(second_task))
+    # Finishing the first task leaves the second one canceled.
+    self.photon_client.task_done([])
+    self.assertFalse(self.photon_client.task_canceled(first_task))
+    self.assertTrue(self.photon_client.task_canceled(second_task))
+    self.photon_client.task_done([])
+    self.photon_client.submit(third_task)
+    new_task = self.photon_client.get_task()
+    self.assertEqual(third_task.arguments(), new_task.arguments())
+    self.assertFalse(self.photon_client.task_canceled(new_task))
+
+  def test_cancel_all(self):
+    driver = photon.PhotonClient(self.scheduler_name)
+    object_id = photon.ObjectID(20 * chr(7))
+    running_task = photon.Task(self.function_id, [1], 0)
+    queued_task = photon.Task(self.function_id, [object_id], 0)
+    driver.submit(running_task)
+    driver.submit(queued_task)
+    # The worker gets the runnable task, the other one waits for the object.
+    new_task = self.photon_client.get_task()
+    self.assertEqual(running_task.arguments(), new_task.arguments())
+    driver.cancel_all()
+    self.assertTrue(self.wait_until_canceled(new_task))
+    # The object becomes available, but the queued task was canceled.
+    self.photon_client.task_done([object_id])
+    self.photon_client.request_task()
+    time.sleep(0.1)
+    self.assertIsNone(self.photon_client.poll_task())
+
+  def test_register_worker(self):
+    # Registering pins the worker to a CPU, so do it from a child process to
+    # leave the affinity of the test process alone.
+    pid = os.fork()
+    if pid == 0:
+      status = 1
+      try:
+        photon_client = photon.PhotonClient(self.scheduler_name)
+        photon_client.register_worker(0)
+        # Registering again is ignored instead of crashing the scheduler.
+        photon_client.register_worker(0)
+        object_id = photon.ObjectID(20 * chr(4))
+        # Report the object as created by this worker, so it is on our NUMA
+        # node.
+        photon_client.task_done([object_id])
+        task = photon.Task(self.function_id, [object_id], 0)
+        photon_client.submit(task)
+        new_task = photon_client.get_task()
+        if object_id.id() == new_task.arguments()[0].id():
+          status = 0
+      finally:
+        os._exit(status)
+    _, status = os.waitpid(pid, 0)
+    self.assertEqual(0, status)
+    # The scheduler is still running.
+    self.assertIsNone(self.p3.poll())
+
+  def test_numa_stats(self):
+    # Restart the scheduler so that we can read the NUMA statistics it logs
+    # when it shuts down.
+    self.p3.kill()
+    self.p3.wait()
+    log = tempfile.TemporaryFile()
+    self.start_scheduler(self.plasma_socket, stderr=log)
+    pid = os.fork()
+    if pid == 0:
+      status = 1
+      try:
+        photon_client = photon.PhotonClient(self.scheduler_name)
+        photon_client.register_worker(0)
+        # The object is on the NUMA node of CPU 0, because this worker
+        # created it, so the task that depends on it has local inputs.
+        object_id = photon.ObjectID(20 * chr(2))
+        photon_client.task_done([object_id])
+        photon_client.submit(photon.Task(self.function_id, [object_id], 0))
+        photon_client.get_task()
+        status = 0
+      finally:
+        os._exit(status)
+    _, status = os.waitpid(pid, 0)
+    self.assertEqual(0, status)
+    # Give the scheduler time to process the disconnection of the worker.
+    time.sleep(0.1)
+    self.p3.send_signal(signal.SIGTERM)
+    self.p3.wait()
+    log.seek(0)
+    # The worker that exited is no longer counted, but its task is.
+    self.assertIn("NUMA node 0: 0 of 0 workers busy, 1 tasks assigned, "
+                  "1 with local inputs", log.read())
+
+  def test_restart_from_snapshot(self):
+    # Restart the scheduler with snapshots enabled.
+    self.p3.kill()
+    self.p3.wait()
+    self.start_scheduler(self.plasma_socket, ["-c", self.snapshot_path])
+    self.photon_client = photon.PhotonClient(self.scheduler_name)
+    tasks = [photon.Task(self.function_id, [i], 1) for i in range(10)]
+    for task in tasks:
+      self.photon_client.submit(task)
+    # This task waits for an object that is only sealed while the scheduler is
+    # down.
+    object_id = photon.ObjectID(20 * chr(1))
+    self.photon_client.submit(photon.Task(self.function_id, [object_id], 0))
+    # Give the scheduler time to journal the tasks, then crash it.
+    time.sleep(0.3)
+    self.p3.kill()
+    self.p3.wait()
+    self.plasma_client.create(object_id.id(), 0)
+    self.plasma_client.seal(object_id.id())
+    self.start_scheduler(self.plasma_socket, ["-c", self.snapshot_path])
+    self.photon_client = photon.PhotonClient(self.scheduler_name)
+    # The queued tasks survive the restart.
+    for task in tasks:
+      new_task = self.photon_client.get_task()
+      self.assertEqual(task.arguments(), new_task.arguments())
+    # The scheduler asked Plasma about the input of the waiting task, so it is
+    # runnable although Plasma did not notify the scheduler about the object.
+    self.photon_client.request_task()
+    new_task = self.wait_for_task()
+    self.assertIsNotNone(new_task)
+    self.assertEqual(object_id.id(), new_task.arguments()[0].id())
+
+  def test_ignore_corrupt_snapshot(self):
+    # Write a snapshot that claims to hold a huge task.
+    with open(self.snapshot_path, "wb") as f:
+      f.write(struct.pack("=Qqqq", 0x50414e5354484f50, 3, 1, 1))
+      f.write(struct.pack("=q20s4xqQ", 1, 20 * b"a", 1 << 40, 0))
+      f.write(100 * b"x")
+    self.p3.kill()
+    self.p3.wait()
+    self.start_scheduler(self.plasma_socket, ["-c", self.snapshot_path])
+    self.photon_client = photon.PhotonClient(self.scheduler_name)
+    # The scheduler ignored the snapshot and works as usual.
+    self.assertIsNone(self.p3.poll())
+    task = photon.Task(self.function_id, [1], 0)
+    self.photon_client.submit(task)
+    self.assertEqual(task.arguments(), self.photon_client.get_task().arguments())
+
+  def test_submit_flow_control(self):
+    # Restart the scheduler so that it admits at most five queued tasks.
+    self.p3.kill()
+    self.p3.wait()
+    self.start_scheduler(self.plasma_socket, ["-Q", "5"])
+    self.photon_client = photon.PhotonClient(self.scheduler_name)
+    object_id = photon.ObjectID(20 * chr(3))
+    # These tasks stay queued because their argument is not available.
+    task = photon.Task(self.function_id, [object_id], 0)
+    for _ in range(5):
+      self.photon_client.submit(task)
+    # Waiting for the first grant of credits does not count as throttling.
+    self.assertEqual(self.photon_client.num_throttled(), 0)
+    # This asks for more credits, which the local scheduler refuses.
+    self.assertFalse(self.photon_client.try_submit(task))
+    time.sleep(0.1)
+    self.assertFalse(self.photon_client.try_submit(task))
+    self.assertEqual(self.photon_client.num_throttled(), 1)
+    # Failing again before the next grant is part of the same episode.
+    self.assertFalse(self.photon_client.try_submit(task))
+    self.assertEqual(self.photon_client.num_throttled(), 1)
+    # Let one task leave the queue, which makes room for another submission.
+    self.plasma_client.create(object_id.id(), 0)
+    self.plasma_client.seal(object_id.id())
+    self.photon_client.get_task()
+    submitted = False
+    for _ in range(1000):
+      submitted = self.photon_client.try_submit(task)
+      if submitted:
+        break
+      time.sleep(0.001)
+    self.assertTrue(submitted)
+
+  def test_submit_flow_control_multiple_clients(self):
+    # Restart the scheduler so that it admits at most five queued tasks.
+    self.p3.kill()
+    self.p3.wait()
+    self.start_scheduler(self.plasma_socket, ["-Q", "5"])
+    self.photon_client = photon.PhotonClient(self.scheduler_name)
+    other_client = photon.PhotonClient(self.scheduler_name)
+    object_id = photon.ObjectID(20 * chr(5))
+    # These tasks stay queued because their argument is not available.
+    task = photon.Task(self.function_id, [object_id], 0)
+    num_submitted = 0
+    for _ in range(20):
+      for client in [self.photon_client, other_client]:
+        if client.try_submit(task):
+          num_submitted += 1
+      time.sleep(0.01)
+    # The credits of both clients together are bounded by the queue length.
+    self.assertEqual(num_submitted, 5)
+
+  def try_submit_until_success(self, client, task):
+    for _ in range(1000):
+      if client.try_submit(task):
+        return True
+      time.sleep(0.001)
+    return False
+
+  def test_submit_flow_control_late_client(self):
+    # Restart the scheduler so that it admits at most five queued tasks.
+    self.p3.kill()
+    self.p3.wait()
+    self.start_scheduler(self.plasma_socket, ["-Q", "5"])
+    self.photon_client = photon.PhotonClient(self.scheduler_name)
+    object_id = photon.ObjectID(20 * chr(8))
+    # These tasks stay queued because their argument is not available.
+    task = photon.Task(self.function_id, [object_id], 0)
+    # The first client takes all the credits, but only uses one and then
+    # stays idle.
+    self.photon_client.submit(task)
+    # A client that connects later can still fill the queue.
+    late_client = photon.PhotonClient(self.scheduler_name)
+    for _ in range(4):
+      self.assertTrue(self.try_submit_until_success(late_client, task))
+    time.sleep(0.1)
+    self.assertFalse(late_client.try_submit(task))
+    # The credits of the first client were taken back, so the queue stays
+    # bounded.
+    self.assertFalse(self.photon_client.try_submit(task))
+
+  def test_trace_export(self):
+    trace_path = "/tmp/photon_trace{}.json".format(random.randint(0, 10000))
+    self.p3.kill()
+    self.p3.wait()
+    self.start_scheduler(self.plasma_socket, ["-t", trace_path])
+    self.photon_client = photon.PhotonClient(self.scheduler_name)
+    for i in range(10):
+      self.photon_client.submit(photon.Task(self.function_id, [i], 1))
+    for i in range(10):
+      self.photon_client.get_task()
+      self.photon_client.task_done([])
+    # Ask the scheduler to export the trace and wait for the file.
+    self.p3.send_signal(signal.SIGUSR1)
+    for _ in range(100):
+      if os.path.exists(trace_path):
+        break
+      time.sleep(0.01)
+    time.sleep(0.1)
+    with open(trace_path) as f:
+      trace = json.load(f)
+    os.remove(trace_path)
+    names = [event["name"] for event in trace["traceEvents"] if event["ph"] == "b"]
+    # The arguments are passed by value, so the tasks are runnable as soon as
+    # they are queued.
+    for name in ["submit", "wait_dependencies", "wait_worker", "dispatch",
+                 "execute"]:
+      self.assertEqual(names.count(name), 10)
+
+class TestEmbeddedScheduler(unittest.TestCase):
+
+  def setUp(self):
+    self.scheduler = photon_embedded.EmbeddedScheduler()
+    self.driver = self.scheduler.add_client()
+    self.worker = self.scheduler.add_client()
+    # TODO(rkn): This should be a FunctionID.
+    self.function_id = photon.ObjectID(20 * "a")
+
+  def tearDown(self):
+    self.scheduler.shutdown()
+
+  def get_task_in_thread(self, worker):
+    # Return a thread that waits for a task for the worker and a list that
+    # holds the task once the thread is done.
+    result = []
+    thread = threading.Thread(
+        target=lambda: result.append(self.scheduler.get_task(worker)))
+    thread.start()
+    return thread, result
+
+  def test_submit_and_get_task(self):
+    task = photon.Task(self.function_id, [1, "hi"], 1)
+    self.scheduler.submit(self.driver, task)
+    new_task = self.scheduler.get_task(self.worker)
+    self.assertEqual(task.arguments(), new_task.arguments())
+    self.assertEqual(task.returns(), new_task.returns())
+
+  def test_unknown_client_index(self):
+    task = photon.Task(self.function_id, [1], 0)
+    for client_index in [-1, 2, 1 << 40]:
+      self.assertRaises(IndexError, self.scheduler.submit, client_index, task)
+      self.assertRaises(IndexError, self.scheduler.get_task, client_index)
+      self.assertRaises(IndexError, self.scheduler.task_done, client_index, [])
+      self.assertRaises(IndexError, self.scheduler.cancel_all, client_index)
+      self.assertRaises(IndexError, self.scheduler.task_canceled, client_index,
+                        task)
+    # The scheduler still works.
+    self.scheduler.submit(self.driver, task)
+    self.assertEqual(task.arguments(),
+                     self.scheduler.get_task(self.worker).arguments())
+
+  def test_get_task_from_worker_threads(self):
+    num_workers = 4
+    num_tasks = 20
+    results = []
+    lock = threading.Lock()
+    def work(worker):
+      while True:
+        task = self.scheduler.get_task(worker)
+        if task is None:
+          return
+        with lock:
+          results.append(task.arguments()[0])
+        self.scheduler.task_done(worker, [])
+    threads = [threading.Thread(target=work,
+                                args=(self.scheduler.add_client(),))
+               for _ in range(num_workers)]
+    for thread in threads:
+      thread.start()
+    for i in range(num_tasks):
+      self.scheduler.submit(self.driver, photon.Task(self.function_id, [i], 1))
+    for _ in range(100):
+      if len(results) == num_tasks:
+        break
+      time.sleep(0.01)
+    # Shutting down wakes up the workers that wait for more tasks.
+    self.scheduler.shutdown()
+    for thread in threads:
+      thread.join()
+    self.assertEqual(sorted(results), list(range(num_tasks)))
+
+  def test_task_done_releases_dependencies(self):
+    object_id = photon.ObjectID(20 * chr(5))
+    self.scheduler.submit(self.driver, photon.Task(self.function_id, [1], 1))
+    self.scheduler.get_task(self.worker)
+    # This task waits for the object.
+    task = photon.Task(self.function_id, [object_id], 1)
+    self.scheduler.submit(self.driver, task)
+    thread, result = self.get_task_in_thread(self.scheduler.add_client())
+    time.sleep(0.1)
+    self.assertEqual(result, [])
+    # Finishing the first task with the object makes the second one runnable.
+    self.scheduler.task_done(self.worker, [object_id])
+    thread.join()
+    self.assertEqual(object_id.id(), result[0].arguments()[0].id())
+
+  def test_cancel(self):
+    object_id = photon.ObjectID(20 * chr(6))
+    task = photon.Task(self.function_id, [object_id], 1)
+    self.scheduler.submit(self.driver, task)
+    self.scheduler.cancel(task)
+    # The object becomes available, but the canceled task is not scheduled.
+    self.scheduler.submit(self.driver, photon.Task(self.function_id, [1], 1))
+    self.assertEqual(self.scheduler.get_task(self.worker).arguments()[0], 1)
+    self.scheduler.task_done(self.worker, [object_id])
+    thread, result = self.get_task_in_thread(self.worker)
+    time.sleep(0.1)
+    self.assertEqual(result, [])
+    # Shutting down makes the waiting worker return None.
+    self.scheduler.shutdown()
+    thread.join()
+    self.assertEqual(result, [None])
+    self.assertIsNone(self.scheduler.get_task(self.worker))
+
+  def test_cancel_running_task(self):
+    task = photon.Task(self.function_id, [1], 1)
+    self.scheduler.submit(self.driver, task)
+    running_task = self.scheduler.get_task(self.worker)
+    self.assertFalse(self.scheduler.task_canceled(self.worker, running_task))
+    self.scheduler.cancel(task)
+    self.assertTrue(self.scheduler.task_canceled(self.worker, running_task))
+    self.scheduler.task_done(self.worker, [])
+    self.assertFalse(self.scheduler.task_canceled(self.worker, running_task))
+
 if __name__ == "__main__":
   if len(sys.argv) > 1:
     # pop the argument so we don't mess with unittest's own argument parser